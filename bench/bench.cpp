@@ -0,0 +1,348 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+import moderna.file_lock;
+
+/*
+  Measures acquire / release latency and throughput of the file locks against std::shared_mutex.
+  Every case forks the requested amount of worker processes, each running the requested amount of
+  threads hammering one lock file with a mix of shared and unique acquisitions, for a fixed
+  duration. Results are written to stdout as CSV or JSON, one record per case. Writer latencies are
+  reported separately as well, since readers can starve writers unless the lock orders them.
+
+  Usage: moderna_file_lock_bench [--format csv|json] [--duration-ms 200] [--threads 1,2,4,8]
+    [--processes 1,2,4] [--read-ratios 0,0.5,0.9,1] [--tmpfs-dir /dev/shm] [--disk-dir .]
+*/
+
+namespace fl = moderna::file_lock;
+
+struct bench_options {
+  std::string format = "csv";
+  std::chrono::milliseconds duration{200};
+  std::vector<size_t> threads{1, 2, 4, 8};
+  std::vector<size_t> processes{1, 2, 4};
+  std::vector<double> read_ratios{0, 0.5, 0.9, 1};
+  std::filesystem::path tmpfs_dir = "/dev/shm";
+  std::filesystem::path disk_dir = std::filesystem::current_path();
+};
+
+struct bench_case {
+  std::string_view mutex;
+  std::string_view filesystem;
+  std::filesystem::path lock_path;
+  size_t processes;
+  size_t threads;
+  double read_ratio;
+};
+
+struct bench_result {
+  uint64_t ops;
+  double ops_per_sec;
+  uint64_t p50_ns;
+  uint64_t p99_ns;
+  uint64_t max_ns;
+  uint64_t write_p99_ns;
+  uint64_t write_max_ns;
+};
+
+/*
+  Memory shared between the benchmark and its worker processes, mapped before forking. Every
+  worker thread owns one slot, latencies are sampled for the first max_samples operations, and
+  for the first max_samples unique acquisitions.
+*/
+struct worker_slot {
+  static constexpr size_t max_samples = 1 << 14;
+  uint64_t ops;
+  uint32_t sample_count;
+  uint32_t write_sample_count;
+  uint32_t samples[max_samples];
+  uint32_t write_samples[max_samples];
+};
+struct shared_region {
+  static constexpr size_t max_workers = 256;
+  double read_ratio;
+  std::atomic<uint32_t> ready;
+  std::atomic<bool> start;
+  std::atomic<bool> stop;
+  worker_slot slots[max_workers];
+};
+
+/*
+  Every mutex kind provides a factory called once per worker process. std::shared_mutex cannot be
+  shared between processes, hence it only runs with one process. with_policy<mutex_t, policy> runs
+  mutex_t created with policy.
+*/
+template <typename mutex_t, fl::lock_policy policy> struct with_policy {};
+template <typename mutex_t> struct mutex_kind {
+  static constexpr bool multi_process = true;
+  static mutex_t open(const std::filesystem::path &path) {
+    return mutex_t::create(path).value();
+  }
+  static mutex_t &get(mutex_t &mut) {
+    return mut;
+  }
+};
+template <typename mutex_t, fl::lock_policy policy>
+struct mutex_kind<with_policy<mutex_t, policy>> {
+  static constexpr bool multi_process = true;
+  static mutex_t open(const std::filesystem::path &path) {
+    return mutex_t::create(path, policy).value();
+  }
+  static mutex_t &get(mutex_t &mut) {
+    return mut;
+  }
+};
+template <> struct mutex_kind<std::shared_mutex> {
+  static constexpr bool multi_process = false;
+  static std::unique_ptr<std::shared_mutex> open(const std::filesystem::path &) {
+    return std::make_unique<std::shared_mutex>();
+  }
+  static std::shared_mutex &get(std::unique_ptr<std::shared_mutex> &mut) {
+    return *mut;
+  }
+};
+
+template <typename mutex_t> void run_thread(mutex_t &mut, shared_region &region, size_t index) {
+  auto &slot = region.slots[index];
+  uint64_t rng = 0x9e3779b97f4a7c15ULL * (index + 1);
+  uint64_t ops = 0;
+  uint32_t writes = 0;
+  region.ready.fetch_add(1);
+  while (!region.start.load(std::memory_order_acquire)) std::this_thread::yield();
+  while (!region.stop.load(std::memory_order_relaxed)) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    bool read = static_cast<double>(rng >> 11) * 0x1.0p-53 < region.read_ratio;
+    auto begin = std::chrono::steady_clock::now();
+    if (read) {
+      mut.lock_shared();
+      mut.unlock_shared();
+    } else {
+      mut.lock();
+      mut.unlock();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    auto sample = static_cast<uint32_t>(std::min<int64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), UINT32_MAX
+    ));
+    if (ops < worker_slot::max_samples) slot.samples[ops] = sample;
+    if (!read && writes < worker_slot::max_samples) slot.write_samples[writes++] = sample;
+    ops += 1;
+  }
+  slot.sample_count = static_cast<uint32_t>(std::min<uint64_t>(ops, worker_slot::max_samples));
+  slot.write_sample_count = writes;
+  slot.ops = ops;
+}
+
+template <typename mutex_t>
+void run_process(const bench_case &c, shared_region &region, size_t process_index) {
+  auto mut = mutex_kind<mutex_t>::open(c.lock_path);
+  auto &target = mutex_kind<mutex_t>::get(mut);
+  std::vector<std::jthread> threads;
+  for (size_t i = 0; i < c.threads; i += 1) {
+    threads.emplace_back([&, i]() { run_thread(target, region, process_index * c.threads + i); });
+  }
+}
+
+template <typename mutex_t>
+bench_result run_case(const bench_case &c, std::chrono::milliseconds duration) {
+  auto *region = static_cast<shared_region *>(mmap(
+    nullptr,
+    sizeof(shared_region),
+    PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+    -1,
+    0
+  ));
+  if (region == MAP_FAILED) throw std::bad_alloc{};
+  size_t workers = c.processes * c.threads;
+  region->read_ratio = c.read_ratio;
+
+  std::vector<pid_t> children;
+  for (size_t p = 0; p < c.processes; p += 1) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      run_process<mutex_t>(c, *region, p);
+      _exit(0);
+    }
+    children.emplace_back(pid);
+  }
+  while (region->ready.load() != workers) std::this_thread::yield();
+  auto begin = std::chrono::steady_clock::now();
+  region->start.store(true, std::memory_order_release);
+  std::this_thread::sleep_for(duration);
+  region->stop.store(true);
+  for (pid_t pid : children) waitpid(pid, nullptr, 0);
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin);
+
+  bench_result result{};
+  std::vector<uint32_t> samples;
+  std::vector<uint32_t> write_samples;
+  for (size_t i = 0; i < workers; i += 1) {
+    const auto &slot = region->slots[i];
+    result.ops += slot.ops;
+    samples.insert(samples.end(), slot.samples, slot.samples + slot.sample_count);
+    write_samples.insert(
+      write_samples.end(), slot.write_samples, slot.write_samples + slot.write_sample_count
+    );
+  }
+  munmap(region, sizeof(shared_region));
+  result.ops_per_sec = static_cast<double>(result.ops) / elapsed.count();
+  if (!samples.empty()) {
+    std::ranges::sort(samples);
+    result.p50_ns = samples[samples.size() / 2];
+    result.p99_ns = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+    result.max_ns = samples.back();
+  }
+  if (!write_samples.empty()) {
+    std::ranges::sort(write_samples);
+    result.write_p99_ns =
+      write_samples[std::min(write_samples.size() - 1, write_samples.size() * 99 / 100)];
+    result.write_max_ns = write_samples.back();
+  }
+  return result;
+}
+
+struct reporter {
+  std::string format;
+  bool first = true;
+
+  void begin() {
+    if (format == "json") std::cout << "[\n";
+    else
+      std::cout << "mutex,filesystem,processes,threads,read_ratio,ops,ops_per_sec,p50_ns,p99_ns,"
+                   "max_ns,write_p99_ns,write_max_ns\n";
+  }
+  void report(const bench_case &c, const bench_result &r) {
+    if (format == "json") {
+      std::cout << (first ? "" : ",\n") << "  {\"mutex\": \"" << c.mutex << "\", \"filesystem\": \""
+                << c.filesystem << "\", \"processes\": " << c.processes
+                << ", \"threads\": " << c.threads << ", \"read_ratio\": " << c.read_ratio
+                << ", \"ops\": " << r.ops << ", \"ops_per_sec\": " << r.ops_per_sec
+                << ", \"p50_ns\": " << r.p50_ns << ", \"p99_ns\": " << r.p99_ns
+                << ", \"max_ns\": " << r.max_ns << ", \"write_p99_ns\": " << r.write_p99_ns
+                << ", \"write_max_ns\": " << r.write_max_ns << "}";
+    } else {
+      std::cout << c.mutex << ',' << c.filesystem << ',' << c.processes << ',' << c.threads << ','
+                << c.read_ratio << ',' << r.ops << ',' << r.ops_per_sec << ',' << r.p50_ns << ','
+                << r.p99_ns << ',' << r.max_ns << ',' << r.write_p99_ns << ','
+                << r.write_max_ns << '\n';
+    }
+    std::cout.flush();
+    first = false;
+  }
+  void end() {
+    if (format == "json") std::cout << "\n]\n";
+  }
+};
+
+template <typename T> std::vector<T> parse_list(std::string_view arg) {
+  std::vector<T> values;
+  while (!arg.empty()) {
+    auto comma = arg.find(',');
+    auto item = arg.substr(0, comma);
+    T value{};
+    std::from_chars(item.data(), item.data() + item.size(), value);
+    values.emplace_back(value);
+    arg = comma == std::string_view::npos ? std::string_view{} : arg.substr(comma + 1);
+  }
+  return values;
+}
+
+bench_options parse_options(std::span<char *> args) {
+  bench_options options;
+  for (size_t i = 1; i + 1 < args.size(); i += 2) {
+    std::string_view key = args[i];
+    std::string_view value = args[i + 1];
+    if (key == "--format") options.format = value;
+    else if (key == "--duration-ms")
+      options.duration = std::chrono::milliseconds{parse_list<int64_t>(value).at(0)};
+    else if (key == "--threads")
+      options.threads = parse_list<size_t>(value);
+    else if (key == "--processes")
+      options.processes = parse_list<size_t>(value);
+    else if (key == "--read-ratios")
+      options.read_ratios = parse_list<double>(value);
+    else if (key == "--tmpfs-dir")
+      options.tmpfs_dir = value;
+    else if (key == "--disk-dir")
+      options.disk_dir = value;
+    else {
+      std::cerr << "unknown option " << key << '\n';
+      std::exit(2);
+    }
+  }
+  return options;
+}
+
+template <typename mutex_t>
+void run_mutex(
+  std::string_view name,
+  std::string_view filesystem,
+  const std::filesystem::path &dir,
+  const bench_options &options,
+  reporter &out
+) {
+  auto lock_path = dir / ("moderna_file_lock_bench_" + std::to_string(getpid()));
+  for (size_t processes : options.processes) {
+    if (processes > 1 && !mutex_kind<mutex_t>::multi_process) continue;
+    for (size_t threads : options.threads) {
+      if (processes * threads > shared_region::max_workers) continue;
+      for (double read_ratio : options.read_ratios) {
+        bench_case c{name, filesystem, lock_path, processes, threads, read_ratio};
+        out.report(c, run_case<mutex_t>(c, options.duration));
+      }
+    }
+  }
+  for (auto extension : {"", ".sys_lock"}) {
+    std::filesystem::remove(std::filesystem::path{lock_path}.concat(extension));
+  }
+}
+
+int main(int argc, char **argv) {
+  auto options = parse_options(std::span{argv, static_cast<size_t>(argc)});
+  reporter out{options.format};
+  out.begin();
+  run_mutex<std::shared_mutex>("std::shared_mutex", "memory", options.tmpfs_dir, options, out);
+  std::pair<std::string_view, std::filesystem::path> filesystems[] = {
+    {"tmpfs", options.tmpfs_dir}, {"disk", options.disk_dir}
+  };
+  for (const auto &[filesystem, dir] : filesystems) {
+    if (!std::filesystem::is_directory(dir)) {
+      std::cerr << "skipping " << filesystem << ", " << dir << " is not a directory\n";
+      continue;
+    }
+    run_mutex<fl::file_mutex>("file_mutex", filesystem, dir, options, out);
+    run_mutex<fl::lf_mutex>("lf_mutex", filesystem, dir, options, out);
+    run_mutex<with_policy<fl::lf_mutex, fl::lock_policy::writer_preferring>>(
+      "lf_mutex(writer_preferring)", filesystem, dir, options, out
+    );
+    run_mutex<with_policy<fl::file_mutex, fl::lock_policy::reader_biased>>(
+      "file_mutex(reader_biased)", filesystem, dir, options, out
+    );
+    run_mutex<with_policy<fl::lf_mutex, fl::lock_policy::reader_biased>>(
+      "lf_mutex(reader_biased)", filesystem, dir, options, out
+    );
+    run_mutex<fl::lf_futex_mutex>("lf_futex_mutex", filesystem, dir, options, out);
+  }
+  out.end();
+}
@@ -1,50 +1,343 @@
+#include <pybind11/chrono.h>
 #include <pybind11/pybind11.h>
+#include <chrono>
+#include <cstdint>
+#include <exception>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stop_token>
 #include <string>
+#include <utility>
 import moderna.file_lock;
 namespace py = pybind11;
-class PythonMutex {
-  moderna::file_lock::lf_mutex _internal_mutex;
+
+/*
+  Every call which may reach a system call releases the GIL, so that threads waiting for a lock,
+  or merely opening one, do not stall the other Python threads. mutex_t is lf_mutex for FileMutex
+  and file_mutex for RawFileMutex.
+*/
+template <typename mutex_t> class PythonMutex {
+  mutex_t _internal_mutex;
   std::string _file_path;
 
+  /*
+    State of a pending asynchronous acquisition, only ever touched while holding the GIL.
+  */
+  struct async_state {
+    py::object owner;
+    py::object loop;
+    py::object future;
+  };
+
 public:
   PythonMutex(const std::string &file_path) :
-    _internal_mutex{moderna::file_lock::lf_mutex::create(file_path).value()} {
-    _file_path = std::filesystem::absolute(std::filesystem::path{file_path}).string();
-  }
+    _internal_mutex{create(file_path)},
+    _file_path{std::filesystem::absolute(std::filesystem::path{file_path}).string()} {}
   void lock() {
     py::gil_scoped_release release;
     _internal_mutex.lock();
   }
   void unlock() {
+    py::gil_scoped_release release;
     _internal_mutex.unlock();
   }
   bool try_lock() {
+    py::gil_scoped_release release;
     return _internal_mutex.try_lock();
   }
+  bool try_lock_for(std::chrono::duration<double> timeout) {
+    py::gil_scoped_release release;
+    return _internal_mutex.try_lock_for(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(timeout)
+    );
+  }
   void lock_shared() {
     py::gil_scoped_release release;
     _internal_mutex.lock_shared();
   }
   bool try_lock_shared() {
+    py::gil_scoped_release release;
     return _internal_mutex.try_lock_shared();
   }
+  bool try_lock_shared_for(std::chrono::duration<double> timeout) {
+    py::gil_scoped_release release;
+    return _internal_mutex.try_lock_shared_for(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(timeout)
+    );
+  }
   void unlock_shared() {
+    py::gil_scoped_release release;
     _internal_mutex.unlock_shared();
   }
+
+  /*
+    Returns an asyncio future resolved once the lock is held, the event loop thread never blocks.
+    Pending acquisitions are polled by the reactor thread of async_lock and completed on a worker
+    of its completion_pool. Cancelling the future abandons the acquisition, releasing the lock if
+    it has been acquired in the meantime.
+  */
+  py::object lock_async(py::object self, bool shared) {
+    py::object loop = py::module_::import("asyncio").attr("get_running_loop")();
+    py::object future = loop.attr("create_future")();
+    std::stop_source stop;
+    future.attr("add_done_callback")(py::cpp_function([stop](py::object future) mutable {
+      if (future.attr("cancelled")().cast<bool>()) stop.request_stop();
+    }));
+    auto *state = new async_state{std::move(self), std::move(loop), future};
+    auto complete = [this, state, shared](auto guard, std::exception_ptr error) {
+      bool acquired = guard.owns_lock();
+      guard.release();
+      py::gil_scoped_acquire gil;
+      std::unique_ptr<async_state> s{state};
+      try {
+        s->loop.attr("call_soon_threadsafe")(py::cpp_function(
+          [this, owner = s->owner, future = s->future, acquired, shared, error]() {
+            if (future.attr("done")().cast<bool>()) {
+              if (acquired) release(shared);
+            } else if (error) {
+              future.attr("set_exception")(python_error(error));
+            } else if (acquired) {
+              future.attr("set_result")(py::none());
+            }
+          }
+        ));
+      } catch (const py::error_already_set &) {
+        /*
+          The event loop has been closed, nobody can take over the lock anymore.
+        */
+        if (acquired) release(shared);
+      }
+    };
+    if (shared) {
+      moderna::file_lock::async_lock_shared(_internal_mutex, std::move(complete), stop.get_token());
+    } else {
+      moderna::file_lock::async_lock(_internal_mutex, std::move(complete), stop.get_token());
+    }
+    return future;
+  }
+
+  PythonMutex clone() {
+    std::optional<mutex_t> mut;
+    {
+      py::gil_scoped_release release;
+      mut.emplace(_internal_mutex.clone().value());
+    }
+    return PythonMutex{std::move(*mut), _file_path};
+  }
   const std::string &file_path() const {
     return _file_path;
   }
+  py::dict stats() const {
+    auto snapshot = _internal_mutex.stats();
+    py::dict stats;
+    stats["unique"] = mode_stats(snapshot.unique);
+    stats["shared"] = mode_stats(snapshot.shared);
+    return stats;
+  }
+
+private:
+  PythonMutex(mutex_t mut, std::string file_path) :
+    _internal_mutex{std::move(mut)}, _file_path{std::move(file_path)} {}
+
+  static mutex_t create(const std::string &file_path) {
+    py::gil_scoped_release release;
+    return mutex_t::create(file_path).value();
+  }
+  void release(bool shared) {
+    if (shared) unlock_shared();
+    else
+      unlock();
+  }
+  static py::object python_error(std::exception_ptr error) {
+    try {
+      std::rethrow_exception(error);
+    } catch (const std::exception &e) {
+      return py::module_::import("builtins").attr("OSError")(e.what());
+    } catch (...) {
+      return py::module_::import("builtins").attr("OSError")("unknown error");
+    }
+  }
+
+  static py::dict mode_stats(const moderna::file_lock::lock_mode_stats &s) {
+    py::dict stats;
+    stats["acquisitions"] = s.acquisitions;
+    stats["try_lock_failures"] = s.try_lock_failures;
+    stats["syscalls"] = s.syscalls;
+    stats["errors"] = s.errors;
+    stats["wait_time_ns"] = histogram(s.wait_time);
+    stats["hold_time_ns"] = histogram(s.hold_time);
+    return stats;
+  }
+  /*
+    Maps the lower bound of every non empty bucket, in nanoseconds, to its count.
+  */
+  static py::dict histogram(const moderna::file_lock::duration_histogram &h) {
+    py::dict buckets;
+    for (size_t i = 0; i < h.buckets.size(); i += 1) {
+      if (h.buckets[i] == 0) continue;
+      buckets[py::int_(h.bucket_floor(i).count())] = h.buckets[i];
+    }
+    return buckets;
+  }
 };
 
-PYBIND11_MODULE(file_lock, m) {
-  py::class_<PythonMutex>(m, "FileMutex")
+/*
+  The object returned by exclusive() and shared(), usable with both with and async with. The
+  lock is acquired on entry, raising TimeoutError if timeout seconds pass first, and released on
+  exit.
+*/
+template <typename mutex_t> class PythonLockGuard {
+  py::object _mutex;
+  bool _shared;
+  std::optional<std::chrono::duration<double>> _timeout;
+
+public:
+  PythonLockGuard(py::object mutex, bool shared, std::optional<std::chrono::duration<double>> t) :
+    _mutex{std::move(mutex)}, _shared{shared}, _timeout{t} {}
+
+  void enter() {
+    auto &mut = _mutex.cast<PythonMutex<mutex_t> &>();
+    if (!_timeout) {
+      if (_shared) mut.lock_shared();
+      else
+        mut.lock();
+      return;
+    }
+    bool acquired = _shared ? mut.try_lock_shared_for(*_timeout) : mut.try_lock_for(*_timeout);
+    if (!acquired) {
+      PyErr_SetString(PyExc_TimeoutError, "timed out waiting for the file lock");
+      throw py::error_already_set{};
+    }
+  }
+  void exit(py::args) {
+    auto &mut = _mutex.cast<PythonMutex<mutex_t> &>();
+    if (_shared) mut.unlock_shared();
+    else
+      mut.unlock();
+  }
+  py::object aenter() {
+    auto &mut = _mutex.cast<PythonMutex<mutex_t> &>();
+    py::object future = mut.lock_async(_mutex, _shared);
+    if (!_timeout) return future;
+    return py::module_::import("asyncio").attr("wait_for")(future, _timeout->count());
+  }
+  py::object aexit(py::args args) {
+    exit(std::move(args));
+    py::object loop = py::module_::import("asyncio").attr("get_running_loop")();
+    py::object done = loop.attr("create_future")();
+    done.attr("set_result")(py::none());
+    return done;
+  }
+};
+
+template <typename mutex_t> void bind_mutex(py::module_ &m, const char *name) {
+  using python_mutex = PythonMutex<mutex_t>;
+  using python_guard = PythonLockGuard<mutex_t>;
+  using timeout_t = std::optional<std::chrono::duration<double>>;
+  py::class_<python_guard>(m, (std::string{name} + "Guard").c_str())
+    .def("__enter__", &python_guard::enter)
+    .def("__exit__", &python_guard::exit)
+    .def("__aenter__", &python_guard::aenter)
+    .def("__aexit__", &python_guard::aexit);
+  py::class_<python_mutex>(m, name)
     .def(py::init<const std::string &>())
-    .def("lock", &PythonMutex::lock)
-    .def("unlock", &PythonMutex::unlock)
-    .def("try_lock", &PythonMutex::try_lock)
-    .def("lock_shared", &PythonMutex::lock_shared)
-    .def("unlock_shared", &PythonMutex::unlock_shared)
-    .def("try_lock_shared", &PythonMutex::try_lock_shared)
-    .def("file_path", &PythonMutex::file_path, py::return_value_policy::copy);
-}
\ No newline at end of file
+    .def("lock", &python_mutex::lock)
+    .def("unlock", &python_mutex::unlock)
+    .def("try_lock", &python_mutex::try_lock)
+    .def("try_lock_for", &python_mutex::try_lock_for, py::arg("timeout"))
+    .def("lock_shared", &python_mutex::lock_shared)
+    .def("unlock_shared", &python_mutex::unlock_shared)
+    .def("try_lock_shared", &python_mutex::try_lock_shared)
+    .def("try_lock_shared_for", &python_mutex::try_lock_shared_for, py::arg("timeout"))
+    .def(
+      "lock_async",
+      [](py::object self) { return self.cast<python_mutex &>().lock_async(self, false); }
+    )
+    .def(
+      "lock_shared_async",
+      [](py::object self) { return self.cast<python_mutex &>().lock_async(self, true); }
+    )
+    .def(
+      "exclusive",
+      [](py::object self, timeout_t timeout) { return python_guard{self, false, timeout}; },
+      py::arg("timeout") = py::none()
+    )
+    .def(
+      "shared",
+      [](py::object self, timeout_t timeout) { return python_guard{self, true, timeout}; },
+      py::arg("timeout") = py::none()
+    )
+    .def("clone", &python_mutex::clone)
+    .def("file_path", &python_mutex::file_path, py::return_value_policy::copy)
+    .def("stats", &python_mutex::stats);
+}
+
+/*
+  FileSemaphore, over file_semaphore. Like PythonMutex, every call which may wait or reach a
+  system call releases the GIL.
+*/
+class PythonSemaphore {
+  moderna::file_lock::file_semaphore _internal_semaphore;
+  std::string _file_path;
+
+public:
+  PythonSemaphore(const std::string &file_path, uint32_t max) :
+    _internal_semaphore{create(file_path, max)},
+    _file_path{std::filesystem::absolute(std::filesystem::path{file_path}).string()} {}
+  void acquire(uint32_t permits) {
+    py::gil_scoped_release release;
+    _internal_semaphore.acquire(permits);
+  }
+  bool try_acquire(uint32_t permits) {
+    py::gil_scoped_release release;
+    return _internal_semaphore.try_acquire(permits);
+  }
+  bool try_acquire_for(std::chrono::duration<double> timeout, uint32_t permits) {
+    py::gil_scoped_release release;
+    return _internal_semaphore.try_acquire_for(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(timeout), permits
+    );
+  }
+  void release(uint32_t permits) {
+    py::gil_scoped_release release;
+    _internal_semaphore.release(permits);
+  }
+  uint32_t max() const {
+    return _internal_semaphore.max();
+  }
+  const std::string &file_path() const {
+    return _file_path;
+  }
+
+private:
+  static moderna::file_lock::file_semaphore create(const std::string &file_path, uint32_t max) {
+    py::gil_scoped_release release;
+    return moderna::file_lock::file_semaphore::create(file_path, max).value();
+  }
+};
+
+void bind_semaphore(py::module_ &m) {
+  py::class_<PythonSemaphore>(m, "FileSemaphore")
+    .def(py::init<const std::string &, uint32_t>(), py::arg("file_path"), py::arg("max"))
+    .def("acquire", &PythonSemaphore::acquire, py::arg("permits") = 1)
+    .def("try_acquire", &PythonSemaphore::try_acquire, py::arg("permits") = 1)
+    .def(
+      "try_acquire_for",
+      &PythonSemaphore::try_acquire_for,
+      py::arg("timeout"),
+      py::arg("permits") = 1
+    )
+    .def("release", &PythonSemaphore::release, py::arg("permits") = 1)
+    .def("max", &PythonSemaphore::max)
+    .def("file_path", &PythonSemaphore::file_path, py::return_value_policy::copy);
+}
+
+PYBIND11_MODULE(file_lock, m) {
+  bind_mutex<moderna::file_lock::lf_mutex>(m, "FileMutex");
+  bind_mutex<moderna::file_lock::file_mutex>(m, "RawFileMutex");
+  bind_semaphore(m);
+  m.attr("STATS_ENABLED") = moderna::file_lock::stats_enabled;
+}
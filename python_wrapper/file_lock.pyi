@@ -1,9 +1,69 @@
+import asyncio
+from datetime import timedelta
+from typing import TypedDict
+
+STATS_ENABLED: bool
+
+class LockModeStats(TypedDict):
+    acquisitions: int
+    try_lock_failures: int
+    syscalls: int
+    errors: int
+    # Maps the lower bound of each log2 bucket, in nanoseconds, to its count.
+    wait_time_ns: dict[int, int]
+    hold_time_ns: dict[int, int]
+
+class LockStats(TypedDict):
+    unique: LockModeStats
+    shared: LockModeStats
+
+class FileMutexGuard:
+    def __enter__(self) -> None: ...
+    def __exit__(self, *args) -> None: ...
+    async def __aenter__(self) -> None: ...
+    async def __aexit__(self, *args) -> None: ...
+
 class FileMutex:
     def __init__(self, path: str): ...
     def lock(self): ...
     def unlock(self): ...
     def try_lock(self) -> bool: ...
+    def try_lock_for(self, timeout: float | timedelta) -> bool: ...
     def lock_shared(self): ...
     def unlock_shared(self): ...
     def try_lock_shared(self) -> bool: ...
+    def try_lock_shared_for(self, timeout: float | timedelta) -> bool: ...
+    # Resolved once the lock is held, cancelling gives up on the lock.
+    def lock_async(self) -> asyncio.Future[None]: ...
+    def lock_shared_async(self) -> asyncio.Future[None]: ...
+    # Raises TimeoutError on entry once timeout seconds have passed.
+    def exclusive(self, timeout: float | timedelta | None = None) -> FileMutexGuard: ...
+    def shared(self, timeout: float | timedelta | None = None) -> FileMutexGuard: ...
+    def clone(self) -> FileMutex: ...
     def file_path(self) -> str: ...
+    def stats(self) -> LockStats: ...
+
+class RawFileMutexGuard:
+    def __enter__(self) -> None: ...
+    def __exit__(self, *args) -> None: ...
+    async def __aenter__(self) -> None: ...
+    async def __aexit__(self, *args) -> None: ...
+
+# Locks the file itself rather than a lock file next to it.
+class RawFileMutex:
+    def __init__(self, path: str): ...
+    def lock(self): ...
+    def unlock(self): ...
+    def try_lock(self) -> bool: ...
+    def try_lock_for(self, timeout: float | timedelta) -> bool: ...
+    def lock_shared(self): ...
+    def unlock_shared(self): ...
+    def try_lock_shared(self) -> bool: ...
+    def try_lock_shared_for(self, timeout: float | timedelta) -> bool: ...
+    def lock_async(self) -> asyncio.Future[None]: ...
+    def lock_shared_async(self) -> asyncio.Future[None]: ...
+    def exclusive(self, timeout: float | timedelta | None = None) -> RawFileMutexGuard: ...
+    def shared(self, timeout: float | timedelta | None = None) -> RawFileMutexGuard: ...
+    def clone(self) -> RawFileMutex: ...
+    def file_path(self) -> str: ...
+    def stats(self) -> LockStats: ...
@@ -1,3 +1,4 @@
+#include <sys/types.h>
 #include <chrono>
 #include <exception>
 #include <filesystem>
@@ -5,6 +6,7 @@
 #include <iostream>
 #include <mutex>
 #include <shared_mutex>
+#include <string>
 #include <string_view>
 #include <thread>
 import moderna.file_lock;
@@ -12,31 +14,123 @@ import moderna.test_lib;
 
 namespace mt = moderna::test_lib;
 
-template <typename Mut> void act_or_exit(Mut &&m, std::string_view act_type) {
+/*
+  The file left by lock_mark_and_exit, the locked file path followed by .mark.
+*/
+std::filesystem::path mark_path;
+/*
+  The file_condition_variable waited on by wait_for_mark, the locked file path followed by .cond.
+*/
+std::filesystem::path cond_path;
+
+/*
+  range is either empty, acting on the whole mutex, or an (offset, length) pair for range mutexes.
+*/
+template <typename Mut, typename... Range>
+void act_or_exit(Mut &&m, std::string_view act_type, Range... range) {
   if (act_type == "test_shared_lockable") {
-    if (m.try_lock_shared()) {
-      m.unlock_shared();
+    if (m.try_lock_shared(range...)) {
+      m.unlock_shared(range...);
       exit(0);
     }
     exit(1);
   } else if (act_type == "test_not_shared_lockable") {
-    if (m.try_lock_shared()) {
-      m.unlock_shared();
+    if (m.try_lock_shared(range...)) {
+      m.unlock_shared(range...);
       exit(1);
     }
     exit(0);
   } else if (act_type == "test_unique_lockable") {
-    if (m.try_lock()) {
-      m.unlock();
+    if (m.try_lock(range...)) {
+      m.unlock(range...);
       exit(0);
     }
     exit(1);
   } else if (act_type == "test_not_unique_lockable") {
-    if (m.try_lock()) {
-      m.unlock();
+    if (m.try_lock(range...)) {
+      m.unlock(range...);
+      exit(1);
+    }
+    exit(0);
+  } else if (act_type == "hold_unique") {
+    {
+      std::unique_lock l{m};
+      std::this_thread::sleep_for(std::chrono::milliseconds{300});
+    }
+    exit(0);
+  } else if (act_type == "hold_shared") {
+    {
+      std::shared_lock l{m};
+      std::this_thread::sleep_for(std::chrono::milliseconds{300});
+    }
+    exit(0);
+  } else if (act_type == "lock_mark_and_exit") {
+    m.lock(range...);
+    std::ofstream{mark_path};
+    exit(0);
+  } else if (act_type == "lock_and_exit") {
+    m.lock(range...);
+    exit(0);
+  } else if (act_type == "lock_shared_and_exit") {
+    m.lock_shared(range...);
+    exit(0);
+  } else if (act_type == "wait_for_mark") {
+    if constexpr (sizeof...(Range) == 0) {
+      auto cv = moderna::file_lock::file_condition_variable::create(cond_path).value();
+      std::unique_lock l{m};
+      if (cv.wait_for(l, std::chrono::seconds{10}, []() {
+            return std::filesystem::exists(mark_path);
+          }))
+        exit(0);
+    }
+    exit(1);
+  } else
+    throw std::bad_exception{};
+}
+
+/*
+  Acts on a file_semaphore, holding one permit at most.
+*/
+void act_on_semaphore_or_exit(moderna::file_lock::file_semaphore &&s, std::string_view act_type) {
+  if (act_type == "test_acquirable") {
+    if (s.try_acquire()) {
+      s.release();
+      exit(0);
+    }
+    exit(1);
+  } else if (act_type == "test_not_acquirable") {
+    if (s.try_acquire()) {
+      s.release();
       exit(1);
     }
     exit(0);
+  } else if (act_type == "hold_permit") {
+    s.acquire();
+    std::this_thread::sleep_for(std::chrono::milliseconds{300});
+    s.release();
+    exit(0);
+  } else if (act_type == "acquire_and_exit") {
+    s.acquire();
+    exit(0);
+  } else
+    throw std::bad_exception{};
+}
+
+/*
+  Attempts to lock path, below the root of the lock hierarchy.
+*/
+void act_on_hierarchy_or_exit(
+  moderna::file_lock::lock_hierarchy &&h, std::string_view act_type, std::string_view path
+) {
+  auto target = h.root() / path;
+  if (act_type == "test_unique_lockable") {
+    exit(h.try_lock(target) ? 0 : 1);
+  } else if (act_type == "test_not_unique_lockable") {
+    exit(h.try_lock(target) ? 1 : 0);
+  } else if (act_type == "test_shared_lockable") {
+    exit(h.try_lock(target, moderna::file_lock::lock_mode::shared) ? 0 : 1);
+  } else if (act_type == "test_not_shared_lockable") {
+    exit(h.try_lock(target, moderna::file_lock::lock_mode::shared) ? 1 : 0);
   } else
     throw std::bad_exception{};
 }
@@ -68,6 +162,8 @@ int main(int argc, char **argv) {
     exit(1);
   }
   std::filesystem::path file_path{argv[1]};
+  mark_path = std::filesystem::path{file_path}.concat(".mark");
+  cond_path = std::filesystem::path{file_path}.concat(".cond");
   std::string_view mut_type{argv[2]};
   std::string_view act_type{argv[3]};
   if (act_type == "fuzz_test") {
@@ -79,11 +175,72 @@ int main(int argc, char **argv) {
       fuzz_test(moderna::file_lock::lf_mutex::create(file_path).value(), file_path, argv[4]);
     } else if (mut_type == "f_mut") {
       fuzz_test(moderna::file_lock::file_mutex::create(file_path).value(), file_path, argv[4]);
+    } else if (mut_type == "lffx_mut") {
+      fuzz_test(moderna::file_lock::lf_futex_mutex::create(file_path).value(), file_path, argv[4]);
     }
   }
   else if (mut_type == "lf_mut") {
     act_or_exit(moderna::file_lock::lf_mutex::create(file_path).value(), act_type);
+  } else if (mut_type == "vlf_mut") {
+    auto m = moderna::file_lock::lf_mutex::create(file_path).value();
+    m.enable_versioning().value();
+    act_or_exit(std::move(m), act_type);
   } else if (mut_type == "f_mut") {
     act_or_exit(moderna::file_lock::file_mutex::create(file_path).value(), act_type);
+  } else if (mut_type == "wplf_mut") {
+    act_or_exit(
+      moderna::file_lock::lf_mutex::create(
+        file_path, moderna::file_lock::lock_policy::writer_preferring
+      )
+        .value(),
+      act_type
+    );
+  } else if (mut_type == "wpf_mut") {
+    act_or_exit(
+      moderna::file_lock::file_mutex::create(
+        file_path, moderna::file_lock::lock_policy::writer_preferring
+      )
+        .value(),
+      act_type
+    );
+  } else if (mut_type == "ofd_mut") {
+    act_or_exit(moderna::file_lock::ofd_file_mutex::create(file_path).value(), act_type);
+  } else if (mut_type == "px_mut") {
+    act_or_exit(moderna::file_lock::posix_file_mutex::create(file_path).value(), act_type);
+  } else if (mut_type == "fx_mut") {
+    act_or_exit(moderna::file_lock::futex_mutex::create(file_path).value(), act_type);
+  } else if (mut_type == "lffx_mut") {
+    act_or_exit(moderna::file_lock::lf_futex_mutex::create(file_path).value(), act_type);
+  } else if (mut_type == "sem") {
+    if (argc != 5) {
+      std::cerr << "Wrong amount of arguments" << std::endl;
+      exit(1);
+    }
+    act_on_semaphore_or_exit(
+      moderna::file_lock::file_semaphore::create(file_path, std::stoul(argv[4])).value(), act_type
+    );
+  } else if (mut_type == "hier") {
+    if (argc != 5) {
+      std::cerr << "Wrong amount of arguments" << std::endl;
+      exit(1);
+    }
+    act_on_hierarchy_or_exit(
+      moderna::file_lock::lock_hierarchy::create(file_path).value(), act_type, argv[4]
+    );
+  } else if (mut_type == "r_mut" || mut_type == "lfr_mut") {
+    auto act = [&](auto &&m) {
+      if (argc == 6) {
+        act_or_exit(
+          m,
+          act_type,
+          static_cast<off_t>(std::stoll(argv[4])),
+          static_cast<off_t>(std::stoll(argv[5]))
+        );
+      } else
+        act_or_exit(m, act_type);
+    };
+    if (mut_type == "r_mut") act(moderna::file_lock::range_mutex::create(file_path).value());
+    else
+      act(moderna::file_lock::lf_range_mutex::create(file_path).value());
   }
 }
\ No newline at end of file
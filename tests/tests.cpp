@@ -1,15 +1,28 @@
+#include <sys/file.h>
 #include <sys/wait.h>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstring>
 #include <exception>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <limits>
 #include <mutex>
+#include <optional>
+#include <ranges>
+#include <set>
 #include <shared_mutex>
 #include <sstream>
+#include <stop_token>
 #include <system_error>
 #include <thread>
 #include <unistd.h>
+#include <vector>
 import moderna.test_lib;
 import moderna.file_lock;
 import moderna.thread_plus;
@@ -44,6 +57,43 @@ public:
   }
 };
 
+/*
+  Fire and forget coroutine running eagerly, used to co_await the asynchronous locks.
+*/
+struct detached_task {
+  struct promise_type {
+    detached_task get_return_object() noexcept {
+      return {};
+    }
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept {
+      std::terminate();
+    }
+  };
+};
+
+/*
+  Name of the mutex type understood by test_child.
+*/
+template <typename T> constexpr const char *child_mutex_type() {
+  if constexpr (std::same_as<T, file_lock::file_mutex>) return "f_mut";
+  else if constexpr (std::same_as<T, file_lock::lazy_file_mutex>) return "f_mut";
+  else if constexpr (std::same_as<T, file_lock::ofd_file_mutex>) return "ofd_mut";
+  else if constexpr (std::same_as<T, file_lock::posix_file_mutex>) return "px_mut";
+  else if constexpr (std::same_as<T, file_lock::range_mutex>) return "r_mut";
+  else if constexpr (std::same_as<T, file_lock::lf_range_mutex>) return "lfr_mut";
+  else if constexpr (std::same_as<T, file_lock::futex_mutex>) return "fx_mut";
+  else if constexpr (std::same_as<T, file_lock::lf_futex_mutex>) return "lffx_mut";
+  else
+    return "lf_mut";
+}
+
 template <typename T>
 auto mutex_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
   return test_lib::make_tester(test_suite, false)
@@ -311,11 +361,7 @@ auto mutex_tester(const std::string &test_suite, const std::filesystem::path &tm
         auto completed_process = subprocess::run(process::static_argument{
           TEST_CHILD,
           file_path.string(),
-          []() {
-            if (std::same_as<T, file_lock::file_mutex>) return "f_mut";
-            else
-              return "lf_mut";
-          }(),
+          child_mutex_type<T>(),
           "test_not_unique_lockable"
         });
         test_lib::assert_equal(completed_process.value().exit_code(), 0);
@@ -330,11 +376,7 @@ auto mutex_tester(const std::string &test_suite, const std::filesystem::path &tm
         auto completed_process = subprocess::run(process::static_argument{
           TEST_CHILD,
           file_path.string(),
-          []() {
-            if (std::same_as<T, file_lock::file_mutex>) return "f_mut";
-            else
-              return "lf_mut";
-          }(),
+          child_mutex_type<T>(),
           "test_shared_lockable"
         });
         test_lib::assert_equal(completed_process.value().exit_code(), 0);
@@ -349,21 +391,13 @@ auto mutex_tester(const std::string &test_suite, const std::filesystem::path &tm
         auto completed_process_unique = subprocess::run(process::static_argument{
           TEST_CHILD,
           file_path.string(),
-          []() {
-            if (std::same_as<T, file_lock::file_mutex>) return "f_mut";
-            else
-              return "lf_mut";
-          }(),
+          child_mutex_type<T>(),
           "test_not_unique_lockable"
         });
         auto completed_process_shared = subprocess::run(process::static_argument{
           TEST_CHILD,
           file_path.string(),
-          []() {
-            if (std::same_as<T, file_lock::file_mutex>) return "f_mut";
-            else
-              return "lf_mut";
-          }(),
+          child_mutex_type<T>(),
           "test_not_shared_lockable"
         });
         test_lib::assert_equal(completed_process_unique.value().exit_code(), 0);
@@ -395,17 +429,34 @@ auto mutex_tester(const std::string &test_suite, const std::filesystem::path &tm
         auto completed_process = subprocess::run(process::static_argument{
           TEST_CHILD,
           file_path.string(),
-          []() {
-            if (std::same_as<T, file_lock::file_mutex>) return "f_mut";
-            else
-              return "lf_mut";
-          }(),
+          child_mutex_type<T>(),
           "test_not_unique_lockable"
         });
         exit_sig.send(2);
         test_lib::assert_equal(completed_process.value().exit_code(), 0);
       }
     )
+    /*
+      A process dying while holding the lock must not keep it locked forever.
+    */
+    .add_test(
+      "recover_from_dead_holder",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto unique_holder = subprocess::run(process::static_argument{
+          TEST_CHILD, file_path.string(), child_mutex_type<T>(), "lock_and_exit"
+        });
+        test_lib::assert_equal(unique_holder.value().exit_code(), 0);
+        std::unique_lock unique_lock{file_mutex};
+        unique_lock.unlock();
+        auto shared_holder = subprocess::run(process::static_argument{
+          TEST_CHILD, file_path.string(), child_mutex_type<T>(), "lock_shared_and_exit"
+        });
+        test_lib::assert_equal(shared_holder.value().exit_code(), 0);
+        std::unique_lock unique_lock_after_shared{file_mutex};
+      }
+    )
     .add_test("unlock_flock_twice_in_a_thread", [&]() {
       std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
       auto file_mutex = T::create(file_path).value();
@@ -417,11 +468,7 @@ auto mutex_tester(const std::string &test_suite, const std::filesystem::path &tm
       auto completed_process = subprocess::run(process::static_argument{
         TEST_CHILD,
         file_path.string(),
-        []() {
-          if (std::same_as<T, file_lock::file_mutex>) return "f_mut";
-          else
-            return "lf_mut";
-        }(),
+        child_mutex_type<T>(),
         "test_not_unique_lockable"
       });
       test_lib::assert_equal(completed_process.value().exit_code(), 0);
@@ -458,12 +505,7 @@ auto fuzzer_tester(const std::string &test_suite, const std::filesystem::path &t
       process_list.emplace_back(subprocess::spawn(process::static_argument{
                                                     TEST_CHILD,
                                                     file_path.string(),
-                                                    []() {
-                                                      if (std::same_as<T, file_lock::file_mutex>)
-                                                        return "f_mut";
-                                                      else
-                                                        return "lf_mut";
-                                                    }(),
+                                                    child_mutex_type<T>(),
                                                     "fuzz_test",
                                                     random_value
                                                   })
@@ -501,43 +543,2520 @@ auto fuzzer_tester(const std::string &test_suite, const std::filesystem::path &t
 }
 
 template <typename T>
-auto undefined_behaviour_tester(
-  const std::string &test_suite, const std::filesystem::path &tmp_fd
-) {
+auto range_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
   return test_lib::make_tester(test_suite)
     .add_test(
-      "unlock_without_lock",
+      "allow_concurrent_disjoint_writes",
       [&]() {
-        auto fpath = tmp_fd / test_lib::random_string(10);
-        auto lock = T::create(fpath).value();
-        lock.unlock();
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto thread_sig = thread_plus::void_channel{};
+        auto cur_sig = thread_plus::void_channel{};
+        SafeThread thread{std::thread{[&]() mutable {
+          auto file_mutex = T::create(file_path).value();
+          file_mutex.lock(0, 100);
+          thread_sig.send();
+          auto _ = cur_sig.recv();
+          file_mutex.unlock(0, 100);
+        }}};
+        auto _ = thread_sig.recv();
+        bool disjoint_locked = file_mutex.try_lock(100, 100);
+        if (disjoint_locked) file_mutex.unlock(100, 100);
+        bool overlap_locked = file_mutex.try_lock(50, 100);
+        if (overlap_locked) file_mutex.unlock(50, 100);
+        cur_sig.send();
+        test_lib::assert_equal(disjoint_locked, true);
+        test_lib::assert_equal(overlap_locked, false);
       }
     )
     .add_test(
-      "unlock_shared_without_lock",
+      "allow_concurrent_disjoint_writes_same_object",
       [&]() {
-        auto fpath = tmp_fd / test_lib::random_string(10);
-        T::create(fpath).value().unlock_shared();
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto thread_sig = thread_plus::void_channel{};
+        auto cur_sig = thread_plus::void_channel{};
+        SafeThread thread{std::thread{[&]() mutable {
+          file_mutex.lock(0, 100);
+          thread_sig.send();
+          auto _ = cur_sig.recv();
+          file_mutex.unlock(0, 100);
+        }}};
+        auto _ = thread_sig.recv();
+        bool disjoint_locked = file_mutex.try_lock(100, 100);
+        if (disjoint_locked) file_mutex.unlock(100, 100);
+        bool overlap_locked = file_mutex.try_lock_shared(50, 100);
+        if (overlap_locked) file_mutex.unlock_shared(50, 100);
+        cur_sig.send();
+        test_lib::assert_equal(disjoint_locked, true);
+        test_lib::assert_equal(overlap_locked, false);
       }
     )
-    .add_test("duplicate", [&]() {
-      auto fpath = tmp_fd / test_lib::random_string(10);
-      auto lock = T::create(fpath).value();
-      auto lock_dup = T::create(fpath).value();
+    /*
+      Two overlapping shared ranges are held through the same descriptor. Releasing one of them
+      must not release the overlapping part still held by the other.
+    */
+    .add_test(
+      "unlock_overlapping_shared_ranges",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        file_mutex.lock_shared(0, 100);
+        file_mutex.lock_shared(50, 100);
+        file_mutex.unlock_shared(0, 100);
+        auto released_part = subprocess::run(process::static_argument{
+          TEST_CHILD,
+          file_path.string(),
+          child_mutex_type<T>(),
+          "test_unique_lockable",
+          "0",
+          "50"
+        });
+        auto held_part = subprocess::run(process::static_argument{
+          TEST_CHILD,
+          file_path.string(),
+          child_mutex_type<T>(),
+          "test_not_unique_lockable",
+          "60",
+          "10"
+        });
+        file_mutex.unlock_shared(50, 100);
+        test_lib::assert_equal(released_part.value().exit_code(), 0);
+        test_lib::assert_equal(held_part.value().exit_code(), 0);
+      }
+    )
+    .add_test("allow_concurrent_multi_process_disjoint_writes", [&]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto file_mutex = T::create(file_path).value();
+      file_mutex.lock(0, 100);
+      auto disjoint = subprocess::run(process::static_argument{
+        TEST_CHILD,
+        file_path.string(),
+        child_mutex_type<T>(),
+        "test_unique_lockable",
+        "100",
+        std::to_string(std::numeric_limits<off_t>::max() - 100)
+      });
+      auto overlap = subprocess::run(process::static_argument{
+        TEST_CHILD,
+        file_path.string(),
+        child_mutex_type<T>(),
+        "test_not_shared_lockable",
+        "99",
+        "1"
+      });
+      file_mutex.unlock(0, 100);
+      test_lib::assert_equal(disjoint.value().exit_code(), 0);
+      test_lib::assert_equal(overlap.value().exit_code(), 0);
+    })
+    .add_test("invalid_ranges_are_rejected", [&]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto file_mutex = T::create(file_path).value();
+      auto rejected = [&](off_t offset, off_t length) {
+        std::error_code ec;
+        bool locked = file_mutex.try_lock(offset, length, ec);
+        return !locked && ec == std::errc::invalid_argument;
+      };
+      bool thrown = false;
+      try {
+        file_mutex.lock_shared(0, 0);
+      } catch (const std::system_error &) {
+        thrown = true;
+      }
+      bool whole_file_locked = file_mutex.try_lock();
+      if (whole_file_locked) file_mutex.unlock();
+      test_lib::assert_equal(rejected(0, 0), true);
+      test_lib::assert_equal(rejected(-1, 10), true);
+      test_lib::assert_equal(rejected(10, -1), true);
+      test_lib::assert_equal(rejected(10, std::numeric_limits<off_t>::max()), true);
+      test_lib::assert_equal(thrown, true);
+      test_lib::assert_equal(whole_file_locked, true);
     });
 }
 
-int main(int argc, char **argv, const char **envp) {
-  process::env::init_global(envp);
-  const std::filesystem::path tmp_fd{"tmp"};
-  DirGuard dir_guard{tmp_fd};
-  // mutex_tester<file_lock::FcntlMutex>("basic::FcntlMutex", tmp_fd).print_or_exit();
-  mutex_tester<file_lock::file_mutex>("basic::file_mutex", tmp_fd).print_or_exit();
-  mutex_tester<file_lock::lf_mutex>("basic::lf_mutex", tmp_fd).print_or_exit();
-  fuzzer_tester<file_lock::file_mutex>("fuzzer::file_mutex", tmp_fd).print_or_exit();
-  fuzzer_tester<file_lock::lf_mutex>("fuzzer::lf_mutex", tmp_fd).print_or_exit();
-  undefined_behaviour_tester<file_lock::file_mutex>("undefined::file_mutex", tmp_fd)
-    .print_or_exit();
-  undefined_behaviour_tester<file_lock::lf_mutex>("undefined::lf_mutex", tmp_fd).print_or_exit();
+/*
+  Number of descriptors currently opened by this process.
+*/
+size_t open_fd_count() {
+  return std::ranges::distance(std::filesystem::directory_iterator{"/proc/self/fd"});
+}
+
+template <typename T>
+auto registry_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "create_shares_descriptor",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        size_t fd_count = open_fd_count();
+        auto file_mutex2 = T::create(file_path).value();
+        auto file_mutex3 = file_mutex2.clone().value();
+        test_lib::assert_equal(open_fd_count(), fd_count);
+      }
+    )
+    .add_test(
+      "create_shares_descriptor_across_paths",
+      [&]() {
+        std::filesystem::path dir_path = tmp_fd / test_lib::random_string(10);
+        std::filesystem::create_directories(dir_path);
+        std::string file_name = test_lib::random_string(10);
+        auto file_mutex = T::create(dir_path / file_name).value();
+        size_t fd_count = open_fd_count();
+        auto file_mutex2 = T::create(dir_path / ".." / dir_path.filename() / file_name).value();
+        test_lib::assert_equal(open_fd_count(), fd_count);
+      }
+    )
+    .add_test(
+      "close_descriptor_with_last_handle",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        size_t fd_count = open_fd_count();
+        {
+          auto file_mutex = T::create(file_path).value();
+          auto file_mutex2 = T::create(file_path).value();
+        }
+        test_lib::assert_equal(open_fd_count(), fd_count);
+      }
+    )
+    .add_test("release_with_last_shared_handle", [&]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto file_mutex = T::create(file_path).value();
+      auto file_mutex2 = T::create(file_path).value();
+      file_mutex.lock_shared();
+      file_mutex2.lock_shared();
+      file_mutex.unlock_shared();
+      auto held = subprocess::run(process::static_argument{
+        TEST_CHILD,
+        file_path.string(),
+        child_mutex_type<T>(),
+        "test_not_unique_lockable"
+      });
+      file_mutex2.unlock_shared();
+      auto released = subprocess::run(process::static_argument{
+        TEST_CHILD,
+        file_path.string(),
+        child_mutex_type<T>(),
+        "test_unique_lockable"
+      });
+      test_lib::assert_equal(held.value().exit_code(), 0);
+      test_lib::assert_equal(released.value().exit_code(), 0);
+    });
+}
+
+template <typename T>
+auto timed_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "try_lock_for_times_out",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto thread_sig = thread_plus::void_channel{};
+        auto cur_sig = thread_plus::void_channel{};
+        SafeThread thread{std::thread{[&]() mutable {
+          auto file_mutex = T::create(file_path).value();
+          std::unique_lock l{file_mutex};
+          thread_sig.send();
+          auto _ = cur_sig.recv();
+        }}};
+        auto _ = thread_sig.recv();
+        auto begin = std::chrono::steady_clock::now();
+        bool unique_locked = file_mutex.try_lock_for(std::chrono::milliseconds{50});
+        bool shared_locked = file_mutex.try_lock_shared_for(std::chrono::milliseconds{50});
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        cur_sig.send();
+        test_lib::assert_equal(unique_locked, false);
+        test_lib::assert_equal(shared_locked, false);
+        test_lib::assert_equal(elapsed >= std::chrono::milliseconds{100}, true);
+      }
+    )
+    .add_test(
+      "try_lock_for_acquires_on_release",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto thread_sig = thread_plus::void_channel{};
+        SafeThread thread{std::thread{[&]() mutable {
+          auto file_mutex = T::create(file_path).value();
+          std::unique_lock l{file_mutex};
+          thread_sig.send();
+          std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        }}};
+        auto _ = thread_sig.recv();
+        auto begin = std::chrono::steady_clock::now();
+        std::unique_lock l{file_mutex, std::chrono::seconds{5}};
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        test_lib::assert_equal(l.owns_lock(), true);
+        test_lib::assert_equal(elapsed < std::chrono::seconds{1}, true);
+      }
+    )
+    .add_test(
+      "try_lock_for_acquires_on_process_release",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto holder = subprocess::spawn(process::static_argument{
+                                          TEST_CHILD,
+                                          file_path.string(),
+                                          child_mutex_type<T>(),
+                                          "hold_unique"
+                                        })
+                        .value();
+        while (file_mutex.try_lock()) {
+          file_mutex.unlock();
+          std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        bool timed_out = !file_mutex.try_lock_shared_for(std::chrono::milliseconds{10});
+        bool acquired = file_mutex.try_lock_for(std::chrono::seconds{5});
+        if (acquired) file_mutex.unlock();
+        holder.wait().value();
+        test_lib::assert_equal(timed_out, true);
+        test_lib::assert_equal(acquired, true);
+      }
+    )
+    .add_test(
+      "short_wait_recovers_dead_holder",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto holder = subprocess::run(process::static_argument{
+          TEST_CHILD, file_path.string(), child_mutex_type<T>(), "lock_and_exit"
+        });
+        test_lib::assert_equal(holder.value().exit_code(), 0);
+        bool acquired = file_mutex.try_lock_for(std::chrono::milliseconds{30});
+        if (acquired) file_mutex.unlock();
+        test_lib::assert_equal(acquired, true);
+      }
+    )
+    .add_test("stop_token_cancels_wait", [&]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto file_mutex = T::create(file_path).value();
+      auto thread_sig = thread_plus::void_channel{};
+      auto cur_sig = thread_plus::void_channel{};
+      std::stop_source stop_source;
+      SafeThread thread{std::thread{[&]() mutable {
+        auto file_mutex = T::create(file_path).value();
+        std::unique_lock l{file_mutex};
+        thread_sig.send();
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        stop_source.request_stop();
+        auto _ = cur_sig.recv();
+      }}};
+      auto _ = thread_sig.recv();
+      bool locked = file_mutex.lock(stop_source.get_token());
+      bool shared_locked =
+        file_mutex.try_lock_shared_for(std::chrono::seconds{5}, stop_source.get_token());
+      cur_sig.send();
+      test_lib::assert_equal(locked, false);
+      test_lib::assert_equal(shared_locked, false);
+    });
+}
+
+template <typename T>
+auto async_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "co_await_does_not_suspend_when_free",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        std::thread::id resumed_on;
+        bool owned = false;
+        [&]() -> detached_task {
+          auto l = co_await file_lock::async_lock(file_mutex);
+          owned = l.owns_lock();
+          resumed_on = std::this_thread::get_id();
+        }();
+        test_lib::assert_equal(owned, true);
+        test_lib::assert_equal(resumed_on == std::this_thread::get_id(), true);
+        test_lib::assert_equal(file_mutex.try_lock(), true);
+        file_mutex.unlock();
+      }
+    )
+    .add_test(
+      "co_await_resumes_on_release",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto holder = T::create(file_path).value();
+        std::unique_lock held{holder};
+        std::promise<bool> owned;
+        auto owned_future = owned.get_future();
+        /*
+          Captures of a coroutine lambda do not outlive the full expression, hence parameters. The
+          lock is released before signalling since file_mutex is destroyed once the test returns.
+        */
+        [](T &file_mutex, std::promise<bool> &owned) -> detached_task {
+          auto l = co_await file_lock::async_lock_shared(file_mutex);
+          bool owns_lock = l.owns_lock();
+          if (owns_lock) l.unlock();
+          owned.set_value(owns_lock);
+        }(file_mutex, owned);
+        bool pending =
+          owned_future.wait_for(std::chrono::milliseconds{50}) == std::future_status::timeout;
+        held.unlock();
+        bool resumed = owned_future.wait_for(std::chrono::seconds{5}) == std::future_status::ready;
+        test_lib::assert_equal(pending, true);
+        test_lib::assert_equal(resumed, true);
+        test_lib::assert_equal(owned_future.get(), true);
+      }
+    )
+    .add_test(
+      "many_pending_acquisitions_complete",
+      [&]() {
+        constexpr size_t waiter_count = 200;
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto holder = T::create(file_path).value();
+        std::unique_lock held{holder};
+        std::mutex result_mut;
+        std::condition_variable result_cv;
+        std::set<std::thread::id> completed_on;
+        size_t owned_count = 0;
+        size_t completed_count = 0;
+        for (size_t i = 0; i < waiter_count; i += 1) {
+          file_lock::async_lock(file_mutex, [&](auto l, std::exception_ptr error) {
+            bool owns_lock = l.owns_lock();
+            if (owns_lock) l.unlock();
+            std::unique_lock result_l{result_mut};
+            completed_on.insert(std::this_thread::get_id());
+            owned_count += owns_lock && !error;
+            completed_count += 1;
+            result_cv.notify_all();
+          });
+        }
+        held.unlock();
+        std::unique_lock result_l{result_mut};
+        bool completed = result_cv.wait_for(result_l, std::chrono::seconds{10}, [&]() {
+          return completed_count == waiter_count;
+        });
+        test_lib::assert_equal(completed, true);
+        test_lib::assert_equal(owned_count, waiter_count);
+        test_lib::assert_equal(completed_on.contains(std::this_thread::get_id()), false);
+      }
+    )
+    .add_test(
+      "blocking_completion_does_not_stall_others",
+      [&]() {
+        std::filesystem::path first_path = tmp_fd / test_lib::random_string(10);
+        std::filesystem::path second_path = tmp_fd / test_lib::random_string(10);
+        auto first = T::create(first_path).value();
+        auto second = T::create(second_path).value();
+        auto first_holder = T::create(first_path).value();
+        auto second_holder = T::create(second_path).value();
+        std::unique_lock first_held{first_holder};
+        std::unique_lock second_held{second_holder};
+        std::promise<void> first_started;
+        std::promise<void> release_first;
+        std::promise<void> first_released;
+        std::promise<bool> second_owned;
+        auto release_first_future = release_first.get_future().share();
+        file_lock::async_lock(first, [&, release_first_future](auto l, std::exception_ptr) {
+          first_started.set_value();
+          release_first_future.wait();
+          l.unlock();
+          first_released.set_value();
+        });
+        file_lock::async_lock(second, [&](auto l, std::exception_ptr) {
+          bool owns_lock = l.owns_lock();
+          if (owns_lock) l.unlock();
+          second_owned.set_value(owns_lock);
+        });
+        first_held.unlock();
+        first_started.get_future().wait();
+        second_held.unlock();
+        auto second_future = second_owned.get_future();
+        bool completed =
+          second_future.wait_for(std::chrono::seconds{5}) == std::future_status::ready;
+        release_first.set_value();
+        first_released.get_future().wait();
+        test_lib::assert_equal(completed, true);
+        test_lib::assert_equal(second_future.get(), true);
+      }
+    )
+    .add_test(
+      "acquires_from_dead_holder",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto holder = subprocess::run(process::static_argument{
+          TEST_CHILD, file_path.string(), child_mutex_type<T>(), "lock_and_exit"
+        });
+        test_lib::assert_equal(holder.value().exit_code(), 0);
+        std::promise<bool> owned;
+        auto owned_future = owned.get_future();
+        file_lock::async_lock(file_mutex, [&](auto l, std::exception_ptr) {
+          bool owns_lock = l.owns_lock();
+          if (owns_lock) l.unlock();
+          owned.set_value(owns_lock);
+        });
+        bool resumed = owned_future.wait_for(std::chrono::seconds{5}) == std::future_status::ready;
+        test_lib::assert_equal(resumed, true);
+        test_lib::assert_equal(owned_future.get(), true);
+      }
+    )
+    .add_test(
+      "acquires_on_process_release",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto holder = subprocess::spawn(process::static_argument{
+                                          TEST_CHILD,
+                                          file_path.string(),
+                                          child_mutex_type<T>(),
+                                          "hold_unique"
+                                        })
+                        .value();
+        while (file_mutex.try_lock()) {
+          file_mutex.unlock();
+          std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        std::promise<bool> owned;
+        auto owned_future = owned.get_future();
+        file_lock::async_lock(file_mutex, [&](auto l, std::exception_ptr) {
+          bool owns_lock = l.owns_lock();
+          if (owns_lock) l.unlock();
+          owned.set_value(owns_lock);
+        });
+        bool resumed = owned_future.wait_for(std::chrono::seconds{5}) == std::future_status::ready;
+        holder.wait().value();
+        test_lib::assert_equal(resumed, true);
+        test_lib::assert_equal(owned_future.get(), true);
+      }
+    )
+    .add_test("stop_token_cancels_pending", [&]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto file_mutex = T::create(file_path).value();
+      auto holder = T::create(file_path).value();
+      std::unique_lock held{holder};
+      std::stop_source stop_source;
+      std::promise<bool> owned;
+      auto owned_future = owned.get_future();
+      [](T &file_mutex, std::stop_token stop, std::promise<bool> &owned) -> detached_task {
+        auto l = co_await file_lock::async_lock(file_mutex, std::move(stop));
+        owned.set_value(l.owns_lock());
+      }(file_mutex, stop_source.get_token(), owned);
+      stop_source.request_stop();
+      bool completed =
+        owned_future.wait_for(std::chrono::seconds{5}) == std::future_status::ready;
+      test_lib::assert_equal(completed, true);
+      test_lib::assert_equal(owned_future.get(), false);
+    });
+}
+
+template <typename T>
+auto nested_shared_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "file_lock_held_until_last_release",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto thread_sig = thread_plus::void_channel{};
+        auto cur_sig = thread_plus::void_channel{};
+        {
+          SafeThread thread{std::thread{[&]() mutable {
+            auto file_mutex = T::create(file_path).value();
+            std::shared_lock l{file_mutex};
+            thread_sig.send();
+            auto _ = cur_sig.recv();
+          }}};
+          auto _ = thread_sig.recv();
+          file_mutex.lock_shared();
+          cur_sig.send();
+        }
+        auto still_held = subprocess::run(process::static_argument{
+          TEST_CHILD,
+          file_path.string(),
+          child_mutex_type<T>(),
+          "test_not_unique_lockable"
+        });
+        file_mutex.unlock_shared();
+        auto released = subprocess::run(process::static_argument{
+          TEST_CHILD,
+          file_path.string(),
+          child_mutex_type<T>(),
+          "test_unique_lockable"
+        });
+        test_lib::assert_equal(still_held.value().exit_code(), 0);
+        test_lib::assert_equal(released.value().exit_code(), 0);
+      }
+    )
+    /*
+      Joining a shared hold of the process only touches memory, the file lock being requested once
+      by the outer hold. System calls are only counted when statistics are compiled in.
+    */
+    .add_test("nested_shared_lock_skips_system_calls", [&]() {
+      constexpr size_t iterations = 1000;
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto file_mutex = T::create(file_path).value();
+      std::shared_lock outer{file_mutex};
+      auto before = file_mutex.stats().shared;
+      for (size_t i = 0; i < iterations; i += 1) {
+        file_mutex.lock_shared();
+        file_mutex.unlock_shared();
+      }
+      auto after = file_mutex.stats().shared;
+      size_t expected = file_lock::stats_enabled ? iterations : 0;
+      test_lib::assert_equal(after.acquisitions - before.acquisitions, expected);
+      test_lib::assert_equal(after.syscalls, before.syscalls);
+    });
+}
+
+template <typename T>
+auto stats_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "counts_acquisitions_and_syscalls",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto other = T::create(file_path).value();
+        file_mutex.lock();
+        file_mutex.unlock();
+        file_mutex.lock_shared();
+        other.lock_shared();
+        bool locked = other.try_lock();
+        other.unlock_shared();
+        file_mutex.unlock_shared();
+        auto stats = other.stats();
+        size_t expected = file_lock::stats_enabled ? 1 : 0;
+        test_lib::assert_equal(locked, false);
+        test_lib::assert_equal(stats.unique.acquisitions, expected);
+        test_lib::assert_equal(stats.unique.try_lock_failures, expected);
+        /*
+          Acquiring uniquely checks the upgrade gate once the file lock is held.
+        */
+        test_lib::assert_equal(stats.unique.syscalls, 3 * expected);
+        test_lib::assert_equal(stats.unique.wait_time.count(), expected);
+        test_lib::assert_equal(stats.unique.hold_time.count(), expected);
+        test_lib::assert_equal(stats.shared.acquisitions, 2 * expected);
+        test_lib::assert_equal(stats.shared.syscalls, 2 * expected);
+        test_lib::assert_equal(stats.shared.errors, size_t{0});
+        test_lib::assert_equal(stats.shared.wait_time.count(), 2 * expected);
+        test_lib::assert_equal(stats.shared.hold_time.count(), expected);
+      }
+    )
+    .add_test("records_wait_time", [&]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto file_mutex = T::create(file_path).value();
+      auto thread_sig = thread_plus::void_channel{};
+      SafeThread thread{std::thread{[&]() mutable {
+        auto file_mutex = T::create(file_path).value();
+        std::unique_lock l{file_mutex};
+        thread_sig.send();
+        std::this_thread::sleep_for(std::chrono::milliseconds{20});
+      }}};
+      auto _ = thread_sig.recv();
+      std::shared_lock l{file_mutex};
+      auto stats = file_mutex.stats();
+      size_t waited = 0;
+      for (size_t i = 0; i < file_lock::duration_histogram::bucket_count; i += 1) {
+        if (file_lock::duration_histogram::bucket_floor(i) >= std::chrono::milliseconds{8}) {
+          waited += stats.shared.wait_time.buckets[i];
+        }
+      }
+      test_lib::assert_equal(waited, file_lock::stats_enabled ? size_t{1} : size_t{0});
+    });
+}
+
+/*
+  Releases the lock, then reports a failure, for testing how callers handle failing releases.
+*/
+template <typename T> struct failing_unlock_mutex {
+  T mut;
+
+  auto id() const {
+    return mut.id();
+  }
+  void lock() {
+    mut.lock();
+  }
+  template <typename Clock, typename Duration>
+  bool try_lock_until(const std::chrono::time_point<Clock, Duration> &t, std::stop_token stop) {
+    return mut.try_lock_until(t, std::move(stop));
+  }
+  template <typename Clock, typename Duration>
+  bool try_lock_shared_until(
+    const std::chrono::time_point<Clock, Duration> &t, std::stop_token stop
+  ) {
+    return mut.try_lock_shared_until(t, std::move(stop));
+  }
+  void unlock() {
+    mut.unlock();
+    throw std::runtime_error{"unlock failed"};
+  }
+  void unlock_shared() {
+    mut.unlock_shared();
+    throw std::runtime_error{"unlock failed"};
+  }
+};
+
+template <typename T>
+auto lock_many_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "locks_every_file_until_released",
+      [&]() {
+        std::vector<std::filesystem::path> paths;
+        std::vector<T> mutexes;
+        for (size_t i = 0; i < 3; i += 1) {
+          paths.emplace_back(tmp_fd / test_lib::random_string(10));
+          mutexes.emplace_back(T::create(paths.back()).value());
+        }
+        auto child_can_lock = [&](const std::filesystem::path &path, const char *act) {
+          auto completed_process = subprocess::run(process::static_argument{
+            TEST_CHILD,
+            path.string(),
+            child_mutex_type<T>(),
+            act
+          });
+          return completed_process.value().exit_code() == 0;
+        };
+        bool held = true;
+        {
+          auto guard = file_lock::lock_many(
+            {{mutexes[0]}, {mutexes[1], file_lock::lock_mode::shared}, {mutexes[2]}}
+          );
+          held = held && guard.owns_lock();
+          held = held && child_can_lock(paths[0], "test_not_shared_lockable");
+          held = held && child_can_lock(paths[1], "test_shared_lockable");
+          held = held && child_can_lock(paths[1], "test_not_unique_lockable");
+          held = held && child_can_lock(paths[2], "test_not_shared_lockable");
+        }
+        bool released = true;
+        for (const auto &path : paths) {
+          released = released && child_can_lock(path, "test_unique_lockable");
+        }
+        test_lib::assert_equal(held, true);
+        test_lib::assert_equal(released, true);
+      }
+    )
+    .add_test(
+      "opposite_orders_do_not_deadlock",
+      [&]() {
+        std::filesystem::path first_path = tmp_fd / test_lib::random_string(10);
+        std::filesystem::path second_path = tmp_fd / test_lib::random_string(10);
+        auto run = [&](bool reversed) {
+          auto first = T::create(first_path).value();
+          auto second = T::create(second_path).value();
+          for (size_t i = 0; i < 200; i += 1) {
+            auto guard = reversed ? file_lock::lock_many({{second}, {first}})
+                                  : file_lock::lock_many({{first}, {second}});
+          }
+        };
+        auto begin = std::chrono::steady_clock::now();
+        {
+          SafeThread forward{std::thread{run, false}};
+          SafeThread backward{std::thread{run, true}};
+        }
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        test_lib::assert_equal(elapsed < std::chrono::seconds{10}, true);
+      }
+    )
+    .add_test(
+      "try_lock_many_holds_nothing_on_failure",
+      [&]() {
+        std::filesystem::path free_path = tmp_fd / test_lib::random_string(10);
+        std::filesystem::path held_path = tmp_fd / test_lib::random_string(10);
+        auto free_mutex = T::create(free_path).value();
+        auto held_mutex = T::create(held_path).value();
+        auto holder = T::create(held_path).value();
+        std::unique_lock held{holder};
+        auto begin = std::chrono::steady_clock::now();
+        bool locked = file_lock::try_lock_many({{free_mutex}, {held_mutex}}).owns_lock();
+        bool timed_locked =
+          file_lock::try_lock_many_for({{free_mutex}, {held_mutex}}, std::chrono::milliseconds{50})
+            .owns_lock();
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        bool free_lockable = free_mutex.try_lock();
+        if (free_lockable) free_mutex.unlock();
+        test_lib::assert_equal(locked, false);
+        test_lib::assert_equal(timed_locked, false);
+        test_lib::assert_equal(elapsed >= std::chrono::milliseconds{50}, true);
+        test_lib::assert_equal(free_lockable, true);
+      }
+    )
+    .add_test(
+      "failed_unlock_releases_the_rest",
+      [&]() {
+        std::vector<std::filesystem::path> paths;
+        std::vector<failing_unlock_mutex<T>> failing;
+        std::vector<T> mutexes;
+        for (size_t i = 0; i < 2; i += 1) {
+          paths.emplace_back(tmp_fd / test_lib::random_string(10));
+          failing.emplace_back(T::create(paths.back()).value());
+          paths.emplace_back(tmp_fd / test_lib::random_string(10));
+          mutexes.emplace_back(T::create(paths.back()).value());
+        }
+        bool thrown = false;
+        {
+          auto guard = file_lock::lock_many(
+            {{failing[0]}, {mutexes[0]}, {failing[1], file_lock::lock_mode::shared}, {mutexes[1]}}
+          );
+          try {
+            guard.unlock();
+          } catch (const std::runtime_error &) {
+            thrown = true;
+          }
+        }
+        {
+          auto guard = file_lock::lock_many({{failing[0]}, {mutexes[0]}});
+        }
+        bool released = true;
+        for (const auto &path : paths) {
+          auto completed_process = subprocess::run(process::static_argument{
+            TEST_CHILD,
+            path.string(),
+            child_mutex_type<T>(),
+            "test_unique_lockable"
+          });
+          released = released && completed_process.value().exit_code() == 0;
+        }
+        test_lib::assert_equal(thrown, true);
+        test_lib::assert_equal(released, true);
+      }
+    )
+    .add_test("same_file_is_locked_once", [&]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto file_mutex = T::create(file_path).value();
+      auto other = T::create(file_path).value();
+      auto guard = file_lock::try_lock_many(
+        {{file_mutex, file_lock::lock_mode::shared}, {other}, {file_mutex}}
+      );
+      auto completed_process = subprocess::run(process::static_argument{
+        TEST_CHILD,
+        file_path.string(),
+        child_mutex_type<T>(),
+        "test_not_shared_lockable"
+      });
+      test_lib::assert_equal(guard.owns_lock(), true);
+      test_lib::assert_equal(completed_process.value().exit_code(), 0);
+    });
+}
+
+auto lock_table_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "same_key_excludes_other_holders",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto table = file_lock::lock_table::create(file_path).value();
+        auto other = file_lock::lock_table::create(file_path).value();
+        std::string key = "object-" + test_lib::random_string(10);
+        auto other_key = key;
+        while (other.stripe_of(other_key) == table.stripe_of(key)) other_key += "x";
+        table.lock(key);
+        bool same_locked = false;
+        bool other_locked = false;
+        {
+          SafeThread thread{std::thread{[&]() {
+            same_locked = other.try_lock_shared(key);
+            if (same_locked) other.unlock_shared(key);
+            other_locked = other.try_lock(other_key);
+            if (other_locked) other.unlock(other_key);
+          }}};
+        }
+        auto completed_process = subprocess::run(process::static_argument{
+          TEST_CHILD,
+          file_path.string(),
+          "r_mut",
+          "test_not_shared_lockable",
+          std::to_string(table.stripe_of(key)),
+          "1"
+        });
+        table.unlock(key);
+        bool released = other.try_lock(key);
+        if (released) other.unlock(key);
+        test_lib::assert_equal(same_locked, false);
+        test_lib::assert_equal(other_locked, true);
+        test_lib::assert_equal(completed_process.value().exit_code(), 0);
+        test_lib::assert_equal(released, true);
+      }
+    )
+    .add_test(
+      "stripes_are_stable",
+      [&]() {
+        auto table = file_lock::lock_table::create(tmp_fd / test_lib::random_string(10)).value();
+        auto small = file_lock::lock_table::create(tmp_fd / test_lib::random_string(10), 7).value();
+        test_lib::assert_equal(table.stripe_count(), file_lock::lock_table::default_stripe_count);
+        test_lib::assert_equal(table.stripe_of(std::string_view{"object-42"}), size_t{1107});
+        test_lib::assert_equal(table.stripe_of(std::string{"object-42"}), size_t{1107});
+        test_lib::assert_equal(table.stripe_of(42), size_t{3733});
+        test_lib::assert_equal(table.stripe_of(uint64_t{42}), size_t{3733});
+        test_lib::assert_equal(small.stripe_of(42) < 7, true);
+      }
+    )
+    .add_test(
+      "shared_keys_and_std_guards",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto table = file_lock::lock_table::create(file_path).value();
+        auto other = file_lock::lock_table::create(file_path).value();
+        auto stripe = table.stripe(1234);
+        bool shared_locked = false;
+        bool unique_locked = true;
+        {
+          std::shared_lock l{stripe};
+          SafeThread thread{std::thread{[&]() {
+            shared_locked = other.try_lock_shared(1234);
+            if (shared_locked) other.unlock_shared(1234);
+            unique_locked = other.try_lock(1234);
+            if (unique_locked) other.unlock(1234);
+          }}};
+        }
+        std::unique_lock l{stripe};
+        test_lib::assert_equal(l.owns_lock(), true);
+        test_lib::assert_equal(shared_locked, true);
+        test_lib::assert_equal(unique_locked, false);
+      }
+    )
+    .add_test(
+      "uses_one_descriptor",
+      [&]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto table = file_lock::lock_table::create(file_path).value();
+        size_t fd_count = open_fd_count();
+        for (int key = 0; key < 1000; key += 1) table.lock_shared(key);
+        test_lib::assert_equal(open_fd_count(), fd_count);
+        for (int key = 0; key < 1000; key += 1) table.unlock_shared(key);
+      }
+    )
+    .add_test("rejects_zero_stripes", [&]() {
+      auto table = file_lock::lock_table::create(tmp_fd / test_lib::random_string(10), 0);
+      test_lib::assert_equal(table.has_value(), false);
+      test_lib::assert_equal(
+        table.error().code(), std::make_error_code(std::errc::invalid_argument)
+      );
+    });
+}
+
+/*
+  Readers overlapping each other keep the shared lock held for as long as the flood lasts, a writer
+  is only let in by lock_policy::writer_preferring.
+*/
+template <typename dir_t>
+concept can_sweep = requires(const dir_t &dir) { dir.sweep(); };
+
+auto lock_directory_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto child_act = [=](const std::filesystem::path &file_path, const char *act) {
+    return subprocess::run(process::static_argument{
+                             TEST_CHILD, file_path.string(), "lf_mut", act
+                           })
+      .value()
+      .exit_code();
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "create_mutex_same_as_lf_mutex",
+      [=]() {
+        std::filesystem::path dir_path = tmp_fd / test_lib::random_string(10);
+        auto dir = file_lock::lock_directory::create(dir_path).value();
+        auto mut = dir.create_mutex("data").value();
+        std::unique_lock l{mut};
+        int excluded = child_act(dir_path / "data", "test_not_shared_lockable");
+        auto other = file_lock::lf_mutex::create(dir_path / "data").value();
+        bool same_id = mut.id().value() == other.id().value();
+        test_lib::assert_equal(mut.path().string(), (dir_path / "data").string());
+        test_lib::assert_equal(excluded, 0);
+        test_lib::assert_equal(same_id, true);
+      }
+    )
+    .add_test(
+      "create_many",
+      [=]() {
+        std::filesystem::path dir_path = tmp_fd / test_lib::random_string(10);
+        auto dir = file_lock::lock_directory::create(dir_path).value();
+        std::vector<std::string> names;
+        for (int i = 0; i < 100; i += 1) {
+          names.emplace_back(std::to_string(i));
+        }
+        auto mutexes = dir.create_many(names).value();
+        std::set<std::pair<dev_t, ino_t>> ids;
+        for (auto &mut : mutexes) {
+          auto id = mut.id().value();
+          ids.emplace(id.dev, id.ino);
+        }
+        int unlocked = child_act(dir_path / "42", "test_unique_lockable");
+        test_lib::assert_equal(mutexes.size(), names.size());
+        test_lib::assert_equal(ids.size(), names.size());
+        test_lib::assert_equal(mutexes[42].path().string(), (dir_path / "42").string());
+        test_lib::assert_equal(unlocked, 0);
+      }
+    )
+    .add_test(
+      "sweep_removes_only_unused",
+      [=]() {
+        std::filesystem::path dir_path = tmp_fd / test_lib::random_string(10);
+        auto dir = file_lock::lock_directory::create(dir_path).value();
+        auto in_use = dir.create_mutex("in_use").value();
+        dir.create_mutex("locked").value();
+        dir.create_mutex("unused").value();
+        std::ofstream{dir_path / "unrelated"};
+        /*
+          Stands for another process holding the lock.
+        */
+        int fd = open((dir_path / "locked.sys_lock").c_str(), O_RDONLY);
+        flock(fd, LOCK_EX);
+        size_t removed = dir.sweep().value();
+        close(fd);
+        auto exists = [&](const char *name) { return std::filesystem::exists(dir_path / name); };
+        test_lib::assert_equal(removed, size_t{1});
+        test_lib::assert_equal(exists("in_use.sys_lock"), true);
+        test_lib::assert_equal(exists("locked.sys_lock"), true);
+        test_lib::assert_equal(exists("unused.sys_lock"), false);
+        test_lib::assert_equal(exists("unrelated"), true);
+      }
+    )
+    .add_test(
+      "sweep_keeps_open_and_range_locked",
+      [=]() {
+        std::filesystem::path dir_path = tmp_fd / test_lib::random_string(10);
+        auto dir = file_lock::lock_directory::create(dir_path).value();
+        dir.create_mutex("open").value();
+        dir.create_mutex("range_locked").value();
+        /*
+          Stand for other processes, one merely having the lock file open, the other holding a
+          byte range lock.
+        */
+        auto ofd_lock = [&](const char *name, off_t offset) {
+          int fd = open((dir_path / name).c_str(), O_RDWR);
+          struct flock info = {
+            .l_type = F_RDLCK, .l_whence = SEEK_SET, .l_start = offset, .l_len = 1
+          };
+          fcntl(fd, F_OFD_SETLK, &info);
+          return fd;
+        };
+        int open_fd = ofd_lock("open.sys_lock", std::numeric_limits<off_t>::max());
+        int locked_fd = ofd_lock("range_locked.sys_lock", 0);
+        size_t removed = dir.sweep().value();
+        close(open_fd);
+        close(locked_fd);
+        auto exists = [&](const char *name) { return std::filesystem::exists(dir_path / name); };
+        test_lib::assert_equal(removed, size_t{0});
+        test_lib::assert_equal(exists("open.sys_lock"), true);
+        test_lib::assert_equal(exists("range_locked.sys_lock"), true);
+      }
+    )
+    .add_test(
+      "open_during_removal_reopens",
+      [=]() {
+        std::filesystem::path dir_path = tmp_fd / test_lib::random_string(10);
+        auto dir = file_lock::lock_directory::create(dir_path).value();
+        auto lock_path = dir_path / "swept.sys_lock";
+        std::ofstream{lock_path};
+        /*
+          Stands for a sweep in another process that has validated the file and is removing it.
+        */
+        int fd = open(lock_path.c_str(), O_RDWR);
+        struct flock info = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
+        fcntl(fd, F_OFD_SETLK, &info);
+        std::thread opener{[&]() { dir.create_mutex("swept").value(); }};
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        std::filesystem::remove(lock_path);
+        close(fd);
+        opener.join();
+        test_lib::assert_equal(std::filesystem::exists(lock_path), true);
+      }
+    )
+    .add_test(
+      "sweep_refuses_record_locks",
+      [=]() {
+        using posix_directory =
+          file_lock::basic_lock_directory<file_lock::basic_lf_mutex<file_lock::posix_file_mutex>>;
+        std::filesystem::path dir_path = tmp_fd / test_lib::random_string(10);
+        auto dir = posix_directory::create(dir_path).value();
+        auto mut = dir.create_mutex("posix").value();
+        std::unique_lock l{mut};
+        int locked = subprocess::run(process::static_argument{
+                                       TEST_CHILD,
+                                       (dir_path / "posix.sys_lock").string(),
+                                       "px_mut",
+                                       "test_not_unique_lockable"
+                                     })
+                       .value()
+                       .exit_code();
+        test_lib::assert_equal(can_sweep<posix_directory>, false);
+        test_lib::assert_equal(can_sweep<file_lock::lock_directory>, true);
+        test_lib::assert_equal(locked, 0);
+      }
+    )
+    .add_test("missing_parent_fails", [=]() {
+      auto dir = file_lock::lock_directory::create("/proc/" + test_lib::random_string(10));
+      test_lib::assert_equal(dir.has_value(), false);
+    });
+}
+
+auto version_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto child_act = [=](const std::filesystem::path &file_path, const char *act) {
+    return subprocess::run(process::static_argument{TEST_CHILD, file_path.string(), "vlf_mut", act})
+      .value()
+      .exit_code();
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "off_until_enabled",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = file_lock::lf_mutex::create(file_path).value();
+        auto lock_path = std::filesystem::path{file_path}.concat(".sys_lock");
+        file_mutex.lock();
+        file_mutex.unlock();
+        auto untouched_size = std::filesystem::file_size(lock_path);
+        file_mutex.lock();
+        bool enabled = file_mutex.enable_versioning().has_value();
+        uint64_t enabled_while_writing = file_mutex.version();
+        file_mutex.unlock();
+        uint64_t after_write = file_mutex.version();
+        file_mutex.lock();
+        file_mutex.unlock();
+        test_lib::assert_equal(untouched_size, uintmax_t{0});
+        test_lib::assert_equal(enabled, true);
+        test_lib::assert_equal(enabled_while_writing, uint64_t{0});
+        test_lib::assert_equal(after_write, uint64_t{0});
+        test_lib::assert_equal(file_mutex.version(), uint64_t{2});
+      }
+    )
+    .add_test(
+      "writers_bump_version",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = file_lock::lf_mutex::create(file_path).value();
+        file_mutex.enable_versioning().value();
+        uint64_t initial = file_mutex.version();
+        file_mutex.lock_shared();
+        file_mutex.unlock_shared();
+        uint64_t after_read = file_mutex.version();
+        file_mutex.lock();
+        uint64_t while_writing = file_mutex.version();
+        file_mutex.unlock();
+        uint64_t after_write = file_mutex.version();
+        test_lib::assert_equal(initial, uint64_t{0});
+        test_lib::assert_equal(after_read, initial);
+        test_lib::assert_equal(while_writing, initial + 1);
+        test_lib::assert_equal(after_write, initial + 2);
+      }
+    )
+    .add_test(
+      "validate_detects_writers",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = file_lock::lf_mutex::create(file_path).value();
+        file_mutex.enable_versioning().value();
+        uint64_t before = file_mutex.begin_read();
+        bool untouched = file_mutex.validate(before);
+        uint64_t during = 0;
+        bool during_valid = true;
+        {
+          auto other = file_mutex.clone().value();
+          std::unique_lock l{other};
+          during = file_mutex.begin_read();
+          during_valid = file_mutex.validate(during);
+        }
+        test_lib::assert_equal(untouched, true);
+        test_lib::assert_equal(during_valid, false);
+        test_lib::assert_equal(file_mutex.validate(before), false);
+        test_lib::assert_equal(file_mutex.validate(during), false);
+        test_lib::assert_equal(file_mutex.validate(file_mutex.begin_read()), true);
+      }
+    )
+    .add_test(
+      "shared_across_processes",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = file_lock::lf_mutex::create(file_path).value();
+        file_mutex.enable_versioning().value();
+        uint64_t before = file_mutex.version();
+        int locked = child_act(file_path, "test_unique_lockable");
+        uint64_t after = file_mutex.version();
+        test_lib::assert_equal(locked, 0);
+        test_lib::assert_equal(after, before + 2);
+      }
+    )
+    .add_test(
+      "writer_dying_invalidates",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = file_lock::lf_mutex::create(file_path).value();
+        file_mutex.enable_versioning().value();
+        int died = child_act(file_path, "lock_and_exit");
+        uint64_t left = file_mutex.begin_read();
+        bool left_valid = file_mutex.validate(left);
+        file_mutex.lock();
+        file_mutex.unlock();
+        uint64_t recovered = file_mutex.begin_read();
+        test_lib::assert_equal(died, 0);
+        test_lib::assert_equal(left % 2, uint64_t{1});
+        test_lib::assert_equal(left_valid, false);
+        test_lib::assert_equal(recovered % 2, uint64_t{0});
+        test_lib::assert_equal(recovered > left, true);
+        test_lib::assert_equal(file_mutex.validate(recovered), true);
+      }
+    );
+}
+
+template <typename T>
+auto reader_bias_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto child_act = [=](const std::filesystem::path &file_path, const char *act) {
+    return subprocess::run(
+             process::static_argument{TEST_CHILD, file_path.string(), child_mutex_type<T>(), act}
+    )
+      .value()
+      .exit_code();
+  };
+  auto create = [](const std::filesystem::path &file_path) {
+    return T::create(file_path, file_lock::lock_policy::reader_biased).value();
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "biased_readers_exclude_processes",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = create(file_path);
+        file_mutex.lock_shared();
+        file_mutex.lock_shared();
+        int shared = child_act(file_path, "test_shared_lockable");
+        int unique = child_act(file_path, "test_not_unique_lockable");
+        file_mutex.unlock_shared();
+        file_mutex.unlock_shared();
+        /*
+          The bias keeps the file lock for a little while after the last reader.
+        */
+        int released = 1;
+        for (size_t i = 0; i < 100 && released != 0; i += 1) {
+          released = child_act(file_path, "test_unique_lockable");
+        }
+        test_lib::assert_equal(shared, 0);
+        test_lib::assert_equal(unique, 0);
+        test_lib::assert_equal(released, 0);
+      }
+    )
+    .add_test(
+      "release_on_another_thread",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = create(file_path);
+        file_mutex.lock_shared();
+        file_mutex.lock_shared();
+        int held = child_act(file_path, "test_not_unique_lockable");
+        std::thread{[&]() {
+          file_mutex.unlock_shared();
+          file_mutex.unlock_shared();
+        }}.join();
+        bool locked = file_mutex.try_lock_for(std::chrono::seconds{1});
+        if (locked) file_mutex.unlock();
+        test_lib::assert_equal(held, 0);
+        test_lib::assert_equal(locked, true);
+      }
+    )
+    .add_test(
+      "writer_revokes_bias",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = create(file_path);
+        auto thread_sender = thread_plus::void_channel{};
+        auto cur_sender = thread_plus::void_channel{};
+        SafeThread thread{std::thread{[&]() mutable {
+          auto reader = create(file_path);
+          reader.lock_shared();
+          reader.unlock_shared();
+          reader.lock_shared();
+          thread_sender.send();
+          auto _ = cur_sender.recv();
+          reader.unlock_shared();
+        }}};
+        auto _ = thread_sender.recv();
+        bool acquired_while_read = file_mutex.try_lock();
+        if (acquired_while_read) file_mutex.unlock();
+        cur_sender.send();
+        file_mutex.lock();
+        bool reader_excluded = !file_mutex.clone().value().try_lock_shared();
+        int other = child_act(file_path, "test_not_shared_lockable");
+        file_mutex.unlock();
+        test_lib::assert_equal(acquired_while_read, false);
+        test_lib::assert_equal(reader_excluded, true);
+        test_lib::assert_equal(other, 0);
+      }
+    )
+    .add_test(
+      "upgrade_biased_hold",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = create(file_path);
+        file_mutex.lock_shared();
+        file_mutex.unlock_shared();
+        file_mutex.lock_shared();
+        bool upgraded = file_mutex.try_upgrade();
+        int other = child_act(file_path, "test_not_shared_lockable");
+        if (upgraded) file_mutex.unlock();
+        else
+          file_mutex.unlock_shared();
+        test_lib::assert_equal(upgraded, true);
+        test_lib::assert_equal(other, 0);
+      }
+    )
+    .add_test(
+      "readers_and_writers_exclude",
+      [=]() {
+        constexpr size_t reader_count = 8;
+        constexpr size_t read_count = 2000;
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        std::atomic<bool> writing{false};
+        std::atomic<bool> overlapped{false};
+        std::atomic<size_t> done{0};
+        {
+          std::vector<std::jthread> threads;
+          for (size_t i = 0; i < reader_count; i += 1) {
+            threads.emplace_back([&]() {
+              auto mut = create(file_path);
+              for (size_t j = 0; j < read_count; j += 1) {
+                std::shared_lock l{mut};
+                if (writing.load()) overlapped = true;
+              }
+              done.fetch_add(1);
+            });
+          }
+          threads.emplace_back([&]() {
+            auto mut = create(file_path);
+            while (done.load() != reader_count) {
+              std::unique_lock l{mut};
+              writing = true;
+              std::this_thread::sleep_for(std::chrono::microseconds{50});
+              writing = false;
+            }
+          });
+        }
+        test_lib::assert_equal(overlapped.load(), false);
+      }
+    );
+}
+
+template <typename T>
+auto condition_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto cond_path = [](const std::filesystem::path &file_path) {
+    return std::filesystem::path{file_path}.concat(".cond");
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "notify_wakes_waiter",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto cv = file_lock::file_condition_variable::create(cond_path(file_path)).value();
+        bool ready = false;
+        bool woken = false;
+        std::jthread thread{[&]() mutable {
+          auto file_mutex = T::create(file_path).value();
+          auto cv = file_lock::file_condition_variable::create(cond_path(file_path)).value();
+          std::unique_lock l{file_mutex};
+          woken = cv.wait_for(l, std::chrono::seconds{10}, [&]() { return ready; });
+        }};
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        auto begin = std::chrono::steady_clock::now();
+        {
+          std::unique_lock l{file_mutex};
+          ready = true;
+        }
+        cv.notify_one();
+        thread.join();
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        test_lib::assert_equal(woken, true);
+        test_lib::assert_equal(elapsed < std::chrono::seconds{5}, true);
+      }
+    )
+    .add_test(
+      "wait_for_times_out_holding_lock",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto cv = file_lock::file_condition_variable::create(cond_path(file_path)).value();
+        std::unique_lock l{file_mutex};
+        auto status = cv.wait_for(l, std::chrono::milliseconds{20});
+        bool satisfied = cv.wait_for(l, std::chrono::milliseconds{20}, []() { return false; });
+        bool other = file_mutex.clone().value().try_lock();
+        test_lib::assert_equal(status == std::cv_status::timeout, true);
+        test_lib::assert_equal(satisfied, false);
+        test_lib::assert_equal(l.owns_lock(), true);
+        test_lib::assert_equal(other, false);
+      }
+    )
+    .add_test(
+      "notify_wakes_process",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        std::filesystem::path mark_path = std::filesystem::path{file_path}.concat(".mark");
+        auto file_mutex = T::create(file_path).value();
+        auto cv = file_lock::file_condition_variable::create(cond_path(file_path)).value();
+        auto waiter = subprocess::spawn(process::static_argument{
+                                          TEST_CHILD,
+                                          file_path.string(),
+                                          child_mutex_type<T>(),
+                                          "wait_for_mark"
+                                        })
+                        .value();
+        std::this_thread::sleep_for(std::chrono::milliseconds{200});
+        auto begin = std::chrono::steady_clock::now();
+        {
+          std::unique_lock l{file_mutex};
+          std::ofstream{mark_path};
+        }
+        cv.notify_all();
+        int woken = waiter.wait().value().exit_code();
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        test_lib::assert_equal(woken, 0);
+        test_lib::assert_equal(elapsed < std::chrono::seconds{5}, true);
+      }
+    )
+    .add_test("stop_token_wakes_waiter", [=]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      std::stop_source stop_source;
+      bool satisfied = true;
+      std::jthread thread{[&]() mutable {
+        auto file_mutex = T::create(file_path).value();
+        auto cv = file_lock::file_condition_variable::create(cond_path(file_path)).value();
+        std::unique_lock l{file_mutex};
+        satisfied = cv.wait(l, stop_source.get_token(), []() { return false; });
+      }};
+      std::this_thread::sleep_for(std::chrono::milliseconds{50});
+      auto begin = std::chrono::steady_clock::now();
+      stop_source.request_stop();
+      thread.join();
+      auto elapsed = std::chrono::steady_clock::now() - begin;
+      test_lib::assert_equal(satisfied, false);
+      test_lib::assert_equal(elapsed < std::chrono::seconds{5}, true);
+    });
+}
+
+auto semaphore_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  constexpr uint32_t permits = 2;
+  auto child_act = [=](const std::filesystem::path &file_path, const char *act) {
+    return subprocess::run(process::static_argument{
+                             TEST_CHILD, file_path.string(), "sem", act, std::to_string(permits)
+                           })
+      .value()
+      .exit_code();
+  };
+  auto create = [=](const std::filesystem::path &file_path) {
+    return file_lock::file_semaphore::create(file_path, permits).value();
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "limits_permits_across_processes",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto sem = create(file_path);
+        sem.acquire();
+        int one_left = child_act(file_path, "test_acquirable");
+        bool second = sem.try_acquire();
+        int none_left = child_act(file_path, "test_not_acquirable");
+        bool third = sem.clone().value().try_acquire();
+        sem.release(2);
+        int released = child_act(file_path, "test_acquirable");
+        test_lib::assert_equal(one_left, 0);
+        test_lib::assert_equal(second, true);
+        test_lib::assert_equal(none_left, 0);
+        test_lib::assert_equal(third, false);
+        test_lib::assert_equal(released, 0);
+      }
+    )
+    .add_test(
+      "weighted_acquire_is_all_or_nothing",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto sem = create(file_path);
+        sem.acquire();
+        bool both = sem.try_acquire(2);
+        bool timed_out = !sem.try_acquire_for(std::chrono::milliseconds{20}, 2);
+        sem.release();
+        bool weighted = sem.try_acquire(2);
+        int other = child_act(file_path, "test_not_acquirable");
+        sem.release(2);
+        bool too_many = false;
+        try {
+          sem.try_acquire(3);
+        } catch (const std::invalid_argument &) {
+          too_many = true;
+        }
+        test_lib::assert_equal(both, false);
+        test_lib::assert_equal(timed_out, true);
+        test_lib::assert_equal(weighted, true);
+        test_lib::assert_equal(other, 0);
+        test_lib::assert_equal(too_many, true);
+      }
+    )
+    .add_test(
+      "count_fixed_at_creation",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto sem = create(file_path);
+        auto other = file_lock::file_semaphore::create(file_path, permits + 1);
+        auto none = file_lock::file_semaphore::create(tmp_fd / test_lib::random_string(10), 0);
+        test_lib::assert_equal(sem.max(), permits);
+        test_lib::assert_equal(other.has_value(), false);
+        test_lib::assert_equal(none.has_value(), false);
+      }
+    )
+    .add_test(
+      "acquire_waits_for_process_release",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto sem = create(file_path);
+        sem.acquire();
+        auto holder = subprocess::spawn(process::static_argument{
+                                          TEST_CHILD,
+                                          file_path.string(),
+                                          "sem",
+                                          "hold_permit",
+                                          std::to_string(permits)
+                                        })
+                        .value();
+        while (sem.try_acquire()) {
+          sem.release();
+          std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        bool acquired = sem.try_acquire_for(std::chrono::seconds{5});
+        holder.wait().value();
+        sem.release(2);
+        test_lib::assert_equal(acquired, true);
+      }
+    )
+    .add_test("dead_process_releases_permits", [=]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto sem = create(file_path);
+      int first = child_act(file_path, "acquire_and_exit");
+      int second = child_act(file_path, "acquire_and_exit");
+      bool both = sem.try_acquire(2);
+      if (both) sem.release(2);
+      test_lib::assert_equal(first, 0);
+      test_lib::assert_equal(second, 0);
+      test_lib::assert_equal(both, true);
+    })
+    .add_test(
+      "threads_never_exceed_permits",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto sem = create(file_path);
+        std::atomic<uint32_t> in_use{0};
+        std::atomic<uint32_t> most{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; t += 1) {
+          threads.emplace_back([&]() {
+            for (int i = 0; i < 200; i += 1) {
+              sem.acquire();
+              uint32_t now = in_use.fetch_add(1) + 1;
+              uint32_t seen = most.load();
+              while (now > seen && !most.compare_exchange_weak(seen, now)) {}
+              in_use.fetch_sub(1);
+              sem.release();
+            }
+          });
+        }
+        for (auto &thread : threads) thread.join();
+        bool drained = sem.try_acquire(permits);
+        if (drained) sem.release(permits);
+        test_lib::assert_equal(most.load() <= permits, true);
+        test_lib::assert_equal(drained, true);
+      }
+    );
+}
+
+auto hierarchy_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto child_act = [=](const std::filesystem::path &root, const char *act, const char *path) {
+    return subprocess::run(process::static_argument{TEST_CHILD, root.string(), "hier", act, path})
+      .value()
+      .exit_code();
+  };
+  auto make_tree = [=]() {
+    std::filesystem::path root = tmp_fd / test_lib::random_string(10);
+    std::filesystem::create_directories(root / "ds");
+    std::filesystem::create_directories(root / "other");
+    return root;
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "writers_below_run_concurrently",
+      [=]() {
+        auto root = make_tree();
+        auto hierarchy = file_lock::lock_hierarchy::create(root).value();
+        auto guard = hierarchy.lock(root / "ds" / "a");
+        int sibling = child_act(root, "test_unique_lockable", "ds/b");
+        int same = child_act(root, "test_not_unique_lockable", "ds/a");
+        int coarse = child_act(root, "test_not_shared_lockable", "ds");
+        int reader = child_act(root, "test_not_shared_lockable", "ds/a");
+        test_lib::assert_equal(guard.owns_lock(), true);
+        test_lib::assert_equal(sibling, 0);
+        test_lib::assert_equal(same, 0);
+        test_lib::assert_equal(coarse, 0);
+        test_lib::assert_equal(reader, 0);
+      }
+    )
+    .add_test(
+      "coarse_reader_excludes_writers_below",
+      [=]() {
+        auto root = make_tree();
+        auto hierarchy = file_lock::lock_hierarchy::create(root).value();
+        auto guard = hierarchy.lock(root / "ds", file_lock::lock_mode::shared);
+        int writer = child_act(root, "test_not_unique_lockable", "ds/a");
+        int reader = child_act(root, "test_shared_lockable", "ds/a");
+        int elsewhere = child_act(root, "test_unique_lockable", "other/a");
+        int whole = child_act(root, "test_not_unique_lockable", ".");
+        test_lib::assert_equal(writer, 0);
+        test_lib::assert_equal(reader, 0);
+        test_lib::assert_equal(elsewhere, 0);
+        test_lib::assert_equal(whole, 0);
+      }
+    )
+    .add_test(
+      "threads_exclude_each_other",
+      [=]() {
+        auto root = make_tree();
+        auto hierarchy = file_lock::lock_hierarchy::create(root).value();
+        auto guard = hierarchy.lock(root / "ds");
+        bool below =
+          hierarchy.try_lock(root / "ds" / "a", file_lock::lock_mode::shared).owns_lock();
+        bool elsewhere = hierarchy.try_lock(root / "other").owns_lock();
+        int after_failure = child_act(root, "test_unique_lockable", "other");
+        guard.unlock();
+        bool released = hierarchy.try_lock(root / "ds" / "a", file_lock::lock_mode::shared)
+                          .owns_lock();
+        int whole = child_act(root, "test_unique_lockable", ".");
+        test_lib::assert_equal(below, false);
+        test_lib::assert_equal(elsewhere, true);
+        test_lib::assert_equal(after_failure, 0);
+        test_lib::assert_equal(released, true);
+        test_lib::assert_equal(whole, 0);
+      }
+    )
+    .add_test("rejects_paths_outside_root", [=]() {
+      auto root = make_tree();
+      auto hierarchy = file_lock::lock_hierarchy::create(root / "ds").value();
+      bool thrown = false;
+      try {
+        hierarchy.lock(root / "other" / "a");
+      } catch (const std::filesystem::filesystem_error &) {
+        thrown = true;
+      }
+      test_lib::assert_equal(thrown, true);
+    });
+}
+
+template <typename T>
+auto lease_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto child_act = [=](const std::filesystem::path &file_path, const char *act) {
+    return subprocess::run(
+             process::static_argument{TEST_CHILD, file_path.string(), child_mutex_type<T>(), act}
+    )
+      .value()
+      .exit_code();
+  };
+  auto create = [](const std::filesystem::path &file_path) {
+    return T::create(file_path, file_lock::lock_policy::leased).value();
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "lease_outlives_readers",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = create(file_path);
+        file_mutex.set_lease_timeout(std::chrono::hours{1});
+        file_mutex.lock_shared();
+        file_mutex.unlock_shared();
+        int shared = child_act(file_path, "test_shared_lockable");
+        int unique = child_act(file_path, "test_not_unique_lockable");
+        /*
+          Ends the lease, which would otherwise keep the file open for the rest of the run.
+        */
+        std::unique_lock{file_mutex};
+        test_lib::assert_equal(shared, 0);
+        test_lib::assert_equal(unique, 0);
+      }
+    )
+    .add_test(
+      "writer_of_process_ends_lease",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = create(file_path);
+        file_mutex.set_lease_timeout(std::chrono::hours{1});
+        file_mutex.lock_shared();
+        file_mutex.unlock_shared();
+        bool acquired = file_mutex.try_lock();
+        int other = child_act(file_path, "test_not_shared_lockable");
+        if (acquired) file_mutex.unlock();
+        test_lib::assert_equal(acquired, true);
+        test_lib::assert_equal(other, 0);
+      }
+    )
+    .add_test(
+      "writer_of_other_process_ends_lease",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = create(file_path);
+        file_mutex.set_lease_timeout(std::chrono::hours{1});
+        file_mutex.lock_shared();
+        file_mutex.unlock_shared();
+        auto begin = std::chrono::steady_clock::now();
+        int writer = child_act(file_path, "lock_and_exit");
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        test_lib::assert_equal(writer, 0);
+        test_lib::assert_equal(elapsed < std::chrono::seconds{5}, true);
+      }
+    )
+    .add_test("idle_lease_expires", [=]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto file_mutex = create(file_path);
+      file_mutex.set_lease_timeout(std::chrono::milliseconds{10});
+      file_mutex.lock_shared();
+      file_mutex.unlock_shared();
+      int released = 1;
+      for (size_t i = 0; i < 100 && released != 0; i += 1) {
+        released = child_act(file_path, "test_unique_lockable");
+      }
+      test_lib::assert_equal(released, 0);
+    });
+}
+
+template <typename T>
+auto cohort_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto child_act = [=](const std::filesystem::path &file_path, const char *act) {
+    return subprocess::run(
+             process::static_argument{TEST_CHILD, file_path.string(), child_mutex_type<T>(), act}
+    )
+      .value()
+      .exit_code();
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "disabled_by_default",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        test_lib::assert_equal(file_mutex.cohort_limit(), 0u);
+        file_mutex.set_cohort_limit(4);
+        test_lib::assert_equal(T::create(file_path).value().cohort_limit(), 4u);
+      }
+    )
+    .add_test(
+      "waiter_is_handed_the_lock",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        file_mutex.set_cohort_limit(4);
+        file_mutex.lock();
+        std::atomic<bool> acquired{false};
+        std::atomic<bool> release{false};
+        std::jthread waiter{[&]() {
+          auto mut = T::create(file_path).value();
+          if (!mut.try_lock_for(std::chrono::seconds{10})) return;
+          acquired = true;
+          while (!release) std::this_thread::sleep_for(std::chrono::milliseconds{1});
+          mut.unlock();
+        }};
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        file_mutex.unlock();
+        while (!acquired) std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        int other = child_act(file_path, "test_not_shared_lockable");
+        release = true;
+        waiter.join();
+        test_lib::assert_equal(other, 0);
+        test_lib::assert_equal(child_act(file_path, "test_unique_lockable"), 0);
+      }
+    )
+    .add_test(
+      "threads_stay_exclusive",
+      [=]() {
+        constexpr size_t thread_count = 4;
+        constexpr size_t lock_count = 200;
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        T::create(file_path).value().set_cohort_limit(8);
+        size_t counter = 0;
+        std::atomic<size_t> running{0};
+        std::atomic<bool> overlapped{false};
+        {
+          std::vector<std::jthread> threads;
+          for (size_t i = 0; i < thread_count; i += 1) {
+            threads.emplace_back([&, i]() {
+              auto mut = T::create(file_path).value();
+              for (size_t j = 0; j < lock_count; j += 1) {
+                if (i % 2 == 0) mut.lock();
+                else if (!mut.try_lock_for(std::chrono::seconds{10})) continue;
+                if (running.fetch_add(1) != 0) overlapped = true;
+                counter += 1;
+                running.fetch_sub(1);
+                mut.unlock();
+              }
+            });
+          }
+        }
+        test_lib::assert_equal(counter, thread_count * lock_count);
+        test_lib::assert_equal(overlapped.load(), false);
+        test_lib::assert_equal(child_act(file_path, "test_unique_lockable"), 0);
+      }
+    )
+    .add_test("limit_lets_other_processes_in", [=]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      T::create(file_path).value().set_cohort_limit(2);
+      std::atomic<bool> done{false};
+      std::vector<std::jthread> threads;
+      for (size_t i = 0; i < 2; i += 1) {
+        threads.emplace_back([&]() {
+          auto mut = T::create(file_path).value();
+          while (!done) {
+            std::unique_lock l{mut};
+          }
+        });
+      }
+      auto begin = std::chrono::steady_clock::now();
+      int writer = child_act(file_path, "lock_and_exit");
+      auto elapsed = std::chrono::steady_clock::now() - begin;
+      done = true;
+      threads.clear();
+      test_lib::assert_equal(writer, 0);
+      test_lib::assert_equal(elapsed < std::chrono::seconds{10}, true);
+    });
+}
+
+template <typename T>
+auto lazy_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto child_act = [=](const std::filesystem::path &file_path, const char *act) {
+    return subprocess::run(
+             process::static_argument{TEST_CHILD, file_path.string(), child_mutex_type<T>(), act}
+    )
+      .value()
+      .exit_code();
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "create_opens_nothing",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto lazy = T::create(file_path).value();
+        size_t opened = T::open_descriptors();
+        test_lib::assert_equal(std::filesystem::exists(file_path), false);
+        test_lib::assert_equal(opened, 0u);
+        lazy.lock();
+        int other = child_act(file_path, "test_not_shared_lockable");
+        size_t locked = T::open_descriptors();
+        lazy.unlock();
+        test_lib::assert_equal(other, 0);
+        test_lib::assert_equal(locked, 1u);
+        test_lib::assert_equal(child_act(file_path, "test_unique_lockable"), 0);
+      }
+    )
+    .add_test(
+      "budget_bounds_open_descriptors",
+      [=]() {
+        size_t budget = T::descriptor_budget();
+        T::set_descriptor_budget(4);
+        std::vector<T> handles;
+        for (size_t i = 0; i < 32; i += 1) {
+          handles.emplace_back(T::create(tmp_fd / test_lib::random_string(10)).value());
+          std::shared_lock l{handles.back()};
+        }
+        size_t opened = T::open_descriptors();
+        {
+          std::unique_lock l{handles.front()};
+        }
+        size_t reopened = T::open_descriptors();
+        handles.clear();
+        size_t closed = T::open_descriptors();
+        T::set_descriptor_budget(budget);
+        test_lib::assert_equal(opened, 4u);
+        test_lib::assert_equal(reopened, 4u);
+        test_lib::assert_equal(closed, 0u);
+      }
+    )
+    .add_test(
+      "held_locks_are_not_evicted",
+      [=]() {
+        size_t budget = T::descriptor_budget();
+        T::set_descriptor_budget(1);
+        std::vector<T> handles;
+        for (size_t i = 0; i < 4; i += 1) {
+          handles.emplace_back(T::create(tmp_fd / test_lib::random_string(10)).value());
+          handles.back().lock();
+        }
+        size_t held = T::open_descriptors();
+        int other = child_act(handles.front().path(), "test_not_shared_lockable");
+        for (auto &handle : handles) handle.unlock();
+        size_t released = T::open_descriptors();
+        int relocked = child_act(handles.front().path(), "test_unique_lockable");
+        handles.clear();
+        T::set_descriptor_budget(budget);
+        test_lib::assert_equal(held, 4u);
+        test_lib::assert_equal(other, 0);
+        test_lib::assert_equal(released, 1u);
+        test_lib::assert_equal(relocked, 0);
+      }
+    )
+    .add_test(
+      "budget_counts_real_descriptors",
+      [=]() {
+        size_t budget = T::descriptor_budget();
+        T::set_descriptor_budget(2);
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        std::vector<T> same_file;
+        for (size_t i = 0; i < 4; i += 1) {
+          same_file.emplace_back(T::create(file_path).value());
+          same_file.back().lock_shared();
+        }
+        size_t shared = T::open_descriptors();
+        for (auto &handle : same_file) handle.unlock_shared();
+        /*
+          Mutexes not opened lazily count against the budget, idle handles make room for them.
+        */
+        auto eager = file_lock::file_mutex::create(tmp_fd / test_lib::random_string(10)).value();
+        auto other_eager =
+          file_lock::file_mutex::create(tmp_fd / test_lib::random_string(10)).value();
+        auto lazy = T::create(tmp_fd / test_lib::random_string(10)).value();
+        {
+          std::unique_lock l{lazy};
+        }
+        size_t eager_counted = T::open_descriptors();
+        same_file.clear();
+        T::set_descriptor_budget(budget);
+        test_lib::assert_equal(shared, 1u);
+        test_lib::assert_equal(eager_counted, 2u);
+      }
+    )
+    .add_test("open_failure_is_reported", [=]() {
+      auto lazy = T::create(tmp_fd / test_lib::random_string(10) / "missing").value();
+      std::error_code ec;
+      lazy.lock(ec);
+      bool thrown = false;
+      try {
+        lazy.lock_shared();
+      } catch (const std::filesystem::filesystem_error &) {
+        thrown = true;
+      }
+      test_lib::assert_equal(static_cast<bool>(ec), true);
+      test_lib::assert_equal(thrown, true);
+      test_lib::assert_equal(T::open_descriptors(), 0u);
+    });
+}
+
+template <typename T>
+auto combining_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto child_act = [=](const std::filesystem::path &file_path, const char *act) {
+    return subprocess::run(
+             process::static_argument{TEST_CHILD, file_path.string(), child_mutex_type<T>(), act}
+    )
+      .value()
+      .exit_code();
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "runs_under_unique_lock",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        int other =
+          file_mutex.combine([&]() { return child_act(file_path, "test_not_shared_lockable"); });
+        test_lib::assert_equal(other, 0);
+        test_lib::assert_equal(child_act(file_path, "test_unique_lockable"), 0);
+      }
+    )
+    .add_test(
+      "exceptions_reach_submitter",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        bool thrown = false;
+        try {
+          file_mutex.combine([]() { throw std::bad_exception{}; });
+        } catch (const std::bad_exception &) {
+          thrown = true;
+        }
+        bool relocked = file_mutex.try_lock();
+        if (relocked) file_mutex.unlock();
+        test_lib::assert_equal(thrown, true);
+        test_lib::assert_equal(relocked, true);
+      }
+    )
+    .add_test(
+      "release_errors_reach_the_batch",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto failing = failing_unlock_mutex<T>{T::create(file_path).value()};
+        if constexpr (requires { failing.mut.combining(); }) {
+          bool ran = false;
+          bool thrown = false;
+          try {
+            failing.mut.combining().run(failing, [&]() { ran = true; });
+          } catch (const std::runtime_error &) {
+            thrown = true;
+          }
+          test_lib::assert_equal(ran, true);
+          test_lib::assert_equal(thrown, true);
+        }
+        test_lib::assert_equal(child_act(file_path, "test_unique_lockable"), 0);
+      }
+    )
+    .add_test(
+      "threads_share_batches",
+      [=]() {
+        constexpr size_t thread_count = 8;
+        constexpr size_t task_count = 200;
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        size_t counter = 0;
+        std::atomic<size_t> running{0};
+        std::atomic<bool> overlapped{false};
+        {
+          std::vector<std::jthread> threads;
+          for (size_t i = 0; i < thread_count; i += 1) {
+            threads.emplace_back([&]() {
+              auto mut = T::create(file_path).value();
+              for (size_t j = 0; j < task_count; j += 1) {
+                size_t previous = mut.combine([&]() {
+                  if (running.fetch_add(1) != 0) overlapped = true;
+                  size_t previous = counter;
+                  counter += 1;
+                  running.fetch_sub(1);
+                  return previous;
+                });
+                if (previous >= thread_count * task_count) overlapped = true;
+              }
+            });
+          }
+        }
+        test_lib::assert_equal(counter, thread_count * task_count);
+        test_lib::assert_equal(overlapped.load(), false);
+      }
+    );
+}
+
+/*
+  The noexcept overloads taking a std::error_code, which T must provide.
+*/
+template <typename T>
+auto error_code_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto child_act = [=](const std::filesystem::path &file_path, const char *act) {
+    return subprocess::run(
+             process::static_argument{TEST_CHILD, file_path.string(), child_mutex_type<T>(), act}
+    )
+      .value()
+      .exit_code();
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "unique_round_trip",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        std::error_code lock_ec = std::make_error_code(std::errc::io_error);
+        std::error_code unlock_ec = lock_ec;
+        file_mutex.lock(lock_ec);
+        int other = child_act(file_path, "test_not_shared_lockable");
+        file_mutex.unlock(unlock_ec);
+        test_lib::assert_equal(static_cast<bool>(lock_ec), false);
+        test_lib::assert_equal(static_cast<bool>(unlock_ec), false);
+        test_lib::assert_equal(other, 0);
+        test_lib::assert_equal(child_act(file_path, "test_unique_lockable"), 0);
+      }
+    )
+    .add_test(
+      "shared_round_trip",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        std::error_code ec;
+        file_mutex.lock_shared(ec);
+        bool nested = file_mutex.try_lock_shared(ec);
+        int shared = child_act(file_path, "test_shared_lockable");
+        int unique = child_act(file_path, "test_not_unique_lockable");
+        file_mutex.unlock_shared(ec);
+        file_mutex.unlock_shared(ec);
+        test_lib::assert_equal(static_cast<bool>(ec), false);
+        test_lib::assert_equal(nested, true);
+        test_lib::assert_equal(shared, 0);
+        test_lib::assert_equal(unique, 0);
+      }
+    )
+    .add_test(
+      "try_lock_held_elsewhere",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto holder = subprocess::spawn(process::static_argument{
+                                          TEST_CHILD,
+                                          file_path.string(),
+                                          child_mutex_type<T>(),
+                                          "hold_unique"
+                                        })
+                        .value();
+        std::error_code ec;
+        while (file_mutex.try_lock(ec)) {
+          file_mutex.unlock(ec);
+          std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        bool failed = static_cast<bool>(ec);
+        bool shared_refused = !file_mutex.try_lock_shared(ec);
+        test_lib::assert_equal(failed, false);
+        test_lib::assert_equal(shared_refused, true);
+        test_lib::assert_equal(static_cast<bool>(ec), false);
+        holder.wait().value();
+      }
+    );
+}
+
+template <typename T>
+auto fairness_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto flood_for = [](T &file_mutex, std::atomic<bool> &flooding, size_t index) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds{3};
+    std::this_thread::sleep_for(std::chrono::microseconds{500 * index});
+    while (flooding && std::chrono::steady_clock::now() < end) {
+      std::shared_lock l{file_mutex};
+      std::this_thread::sleep_for(std::chrono::milliseconds{2});
+    }
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "writer_of_other_process_is_not_starved",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path, file_lock::lock_policy::writer_preferring).value();
+        std::atomic<bool> flooding = true;
+        std::chrono::steady_clock::duration elapsed;
+        std::optional<int> exit_code;
+        {
+          std::vector<std::jthread> readers;
+          for (size_t i = 0; i < 4; i += 1) {
+            readers.emplace_back(flood_for, std::ref(file_mutex), std::ref(flooding), i);
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds{50});
+          auto begin = std::chrono::steady_clock::now();
+          auto completed_process = subprocess::run(process::static_argument{
+            TEST_CHILD,
+            file_path.string(),
+            std::string{"wp"} + child_mutex_type<T>(),
+            "lock_and_exit"
+          });
+          elapsed = std::chrono::steady_clock::now() - begin;
+          flooding = false;
+          exit_code = completed_process.value().exit_code();
+        }
+        test_lib::assert_equal(exit_code.value(), 0);
+        test_lib::assert_equal(elapsed < std::chrono::seconds{1}, true);
+      }
+    )
+    .add_test(
+      "writer_of_same_process_is_not_starved",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path, file_lock::lock_policy::writer_preferring).value();
+        auto writer = file_mutex.clone().value();
+        std::atomic<bool> flooding = true;
+        std::chrono::steady_clock::duration elapsed;
+        {
+          std::vector<std::jthread> readers;
+          for (size_t i = 0; i < 4; i += 1) {
+            readers.emplace_back(flood_for, std::ref(file_mutex), std::ref(flooding), i);
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds{50});
+          auto begin = std::chrono::steady_clock::now();
+          writer.lock();
+          elapsed = std::chrono::steady_clock::now() - begin;
+          writer.unlock();
+          flooding = false;
+        }
+        test_lib::assert_equal(writer.policy(), file_lock::lock_policy::writer_preferring);
+        test_lib::assert_equal(elapsed < std::chrono::seconds{1}, true);
+      }
+    )
+    .add_test("new_readers_wait_for_writer", [=]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto file_mutex = T::create(file_path, file_lock::lock_policy::writer_preferring).value();
+      auto unordered = T::create(file_path).value();
+      auto thread_sig = thread_plus::void_channel{};
+      auto cur_sig = thread_plus::void_channel{};
+      SafeThread holder{std::thread{[&]() {
+        file_mutex.lock_shared();
+        thread_sig.send();
+        auto _ = cur_sig.recv();
+        file_mutex.unlock_shared();
+      }}};
+      auto _ = thread_sig.recv();
+      auto writer = subprocess::spawn(process::static_argument{
+                                        TEST_CHILD,
+                                        file_path.string(),
+                                        std::string{"wp"} + child_mutex_type<T>(),
+                                        "lock_and_exit"
+                                      })
+                      .value();
+      auto end = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+      bool refused = false;
+      while (!refused && std::chrono::steady_clock::now() < end) {
+        refused = !file_mutex.try_lock_shared_for(std::chrono::milliseconds{1});
+        if (!refused) file_mutex.unlock_shared();
+      }
+      bool unordered_locked = unordered.try_lock_shared();
+      if (unordered_locked) unordered.unlock_shared();
+      cur_sig.send();
+      writer.wait().value();
+      test_lib::assert_equal(refused, true);
+      test_lib::assert_equal(unordered_locked, true);
+    });
+}
+
+template <typename T>
+auto upgrade_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto child_act = [=](const std::filesystem::path &file_path, const char *act) {
+    return subprocess::run(process::static_argument{
+                             TEST_CHILD, file_path.string(), child_mutex_type<T>(), act
+                           })
+      .value()
+      .exit_code();
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "downgrade_keeps_lock",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto shared = file_lock::downgrade(std::unique_lock{file_mutex});
+        int readable = child_act(file_path, "test_shared_lockable");
+        int held = child_act(file_path, "test_not_unique_lockable");
+        shared.unlock();
+        int released = child_act(file_path, "test_unique_lockable");
+        test_lib::assert_equal(shared.owns_lock(), false);
+        test_lib::assert_equal(readable, 0);
+        test_lib::assert_equal(held, 0);
+        test_lib::assert_equal(released, 0);
+      }
+    )
+    .add_test(
+      "upgrade_guard_excludes_readers",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        std::shared_lock l{file_mutex};
+        int excluded = 1;
+        bool upgraded = false;
+        {
+          file_lock::upgrade_guard g{l};
+          upgraded = g.owns_lock();
+          excluded = child_act(file_path, "test_not_shared_lockable");
+        }
+        int readable = child_act(file_path, "test_shared_lockable");
+        int held = child_act(file_path, "test_not_unique_lockable");
+        test_lib::assert_equal(upgraded, true);
+        test_lib::assert_equal(excluded, 0);
+        test_lib::assert_equal(readable, 0);
+        test_lib::assert_equal(held, 0);
+      }
+    )
+    .add_test(
+      "upgrade_waits_for_other_readers",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        auto thread_sig = thread_plus::void_channel{};
+        auto cur_sig = thread_plus::void_channel{};
+        SafeThread reader{std::thread{[&]() {
+          std::shared_lock l{file_mutex};
+          thread_sig.send();
+          auto _ = cur_sig.recv();
+          std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        }}};
+        auto _ = thread_sig.recv();
+        file_mutex.lock_shared();
+        bool tried = file_mutex.try_upgrade();
+        bool timed_out = !file_mutex.upgrade_for(std::chrono::milliseconds{20});
+        int held = child_act(file_path, "test_not_unique_lockable");
+        cur_sig.send();
+        bool upgraded = file_mutex.upgrade_for(std::chrono::seconds{5});
+        if (upgraded) file_mutex.unlock();
+        else
+          file_mutex.unlock_shared();
+        test_lib::assert_equal(tried, false);
+        test_lib::assert_equal(timed_out, true);
+        test_lib::assert_equal(held, 0);
+        test_lib::assert_equal(upgraded, true);
+      }
+    )
+    .add_test(
+      "failed_upgrade_keeps_shared_lock",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        file_mutex.lock_shared();
+        auto reader =
+          subprocess::spawn(process::static_argument{
+                              TEST_CHILD, file_path.string(), child_mutex_type<T>(), "hold_shared"
+                            })
+            .value();
+        std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        auto begin = std::chrono::steady_clock::now();
+        bool tried = file_mutex.try_upgrade();
+        bool timed = file_mutex.upgrade_for(std::chrono::milliseconds{20});
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        reader.wait().value();
+        int held = child_act(file_path, "test_not_unique_lockable");
+        int readable = child_act(file_path, "test_shared_lockable");
+        file_mutex.unlock_shared();
+        test_lib::assert_equal(tried, false);
+        test_lib::assert_equal(timed, false);
+        test_lib::assert_equal(elapsed < std::chrono::milliseconds{150}, true);
+        test_lib::assert_equal(held, 0);
+        test_lib::assert_equal(readable, 0);
+      }
+    )
+    /*
+      The upgrade cannot convert while another process reads, and a writer of a third process is
+      already waiting. The writer must not get in before the upgrade.
+    */
+    .add_test("writer_does_not_slip_in", [=]() {
+      std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+      auto mark_path = std::filesystem::path{file_path}.concat(".mark");
+      auto file_mutex = T::create(file_path).value();
+      file_mutex.lock_shared();
+      auto reader =
+        subprocess::spawn(process::static_argument{
+                            TEST_CHILD, file_path.string(), child_mutex_type<T>(), "hold_shared"
+                          })
+          .value();
+      std::this_thread::sleep_for(std::chrono::milliseconds{100});
+      auto writer = subprocess::spawn(process::static_argument{
+                                        TEST_CHILD,
+                                        file_path.string(),
+                                        child_mutex_type<T>(),
+                                        "lock_mark_and_exit"
+                                      })
+                      .value();
+      std::this_thread::sleep_for(std::chrono::milliseconds{50});
+      bool upgraded = file_mutex.upgrade_for(std::chrono::seconds{5});
+      bool writer_first = std::filesystem::exists(mark_path);
+      if (upgraded) file_mutex.unlock();
+      else
+        file_mutex.unlock_shared();
+      reader.wait().value();
+      writer.wait().value();
+      test_lib::assert_equal(upgraded, true);
+      test_lib::assert_equal(writer_first, false);
+      test_lib::assert_equal(std::filesystem::exists(mark_path), true);
+    });
+}
+
+template <typename T>
+auto mapped_view_tester(const std::string &test_suite, const std::filesystem::path &tmp_fd) {
+  auto child_act = [=](const std::filesystem::path &file_path, const char *act) {
+    return subprocess::run(process::static_argument{
+                             TEST_CHILD, file_path.string(), child_mutex_type<T>(), act
+                           })
+      .value()
+      .exit_code();
+  };
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "read_view_holds_shared_lock",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        std::ofstream{file_path} << "hello world";
+        auto file_mutex = T::create(file_path).value();
+        std::string content;
+        int readable = 1;
+        int held = 1;
+        {
+          auto view = file_mutex.read_view().value();
+          content = view.str();
+          readable = child_act(file_path, "test_shared_lockable");
+          held = child_act(file_path, "test_not_unique_lockable");
+        }
+        int released = child_act(file_path, "test_unique_lockable");
+        test_lib::assert_equal(content, std::string{"hello world"});
+        test_lib::assert_equal(readable, 0);
+        test_lib::assert_equal(held, 0);
+        test_lib::assert_equal(released, 0);
+      }
+    )
+    .add_test(
+      "read_view_missing_file",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        bool mapped = file_mutex.read_view().has_value();
+        int released = child_act(file_path, "test_unique_lockable");
+        test_lib::assert_equal(mapped, false);
+        test_lib::assert_equal(released, 0);
+      }
+    )
+    .add_test(
+      "write_view_in_place",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        auto file_mutex = T::create(file_path).value();
+        int excluded = 1;
+        {
+          auto view = file_mutex.write_view(5).value();
+          std::memcpy(view.data().data(), "abcde", view.size());
+          view.sync().value();
+          excluded = child_act(file_path, "test_not_shared_lockable");
+        }
+        std::string content{file_mutex.read_view().value().str()};
+        test_lib::assert_equal(content, std::string{"abcde"});
+        test_lib::assert_equal(excluded, 0);
+      }
+    )
+    .add_test(
+      "write_replace_waits_for_readers",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        std::ofstream{file_path} << "old content";
+        auto file_mutex = T::create(file_path).value();
+        std::optional view{file_mutex.read_view().value()};
+        std::atomic<bool> replaced = false;
+        std::thread writer{[&]() {
+          file_mutex.write_replace([](std::ostream &out) { out << "new content"; }).value();
+          replaced = true;
+        }};
+        std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        bool replaced_early = replaced;
+        std::string old_content{view->str()};
+        view.reset();
+        writer.join();
+        std::string new_content{file_mutex.read_view().value().str()};
+        auto tmp_path = std::filesystem::path{file_path}.concat(".sys_tmp");
+        bool tmp_left = std::filesystem::exists(tmp_path);
+        test_lib::assert_equal(replaced_early, false);
+        test_lib::assert_equal(old_content, std::string{"old content"});
+        test_lib::assert_equal(new_content, std::string{"new content"});
+        test_lib::assert_equal(tmp_left, false);
+      }
+    )
+    .add_test(
+      "write_replace_removes_tmp_on_throw",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        std::ofstream{file_path} << "old content";
+        auto file_mutex = T::create(file_path).value();
+        bool rethrown = false;
+        try {
+          file_mutex
+            .write_replace([](std::ostream &out) {
+              out << "partial";
+              throw std::runtime_error{"write failed"};
+            })
+            .value();
+        } catch (const std::runtime_error &) {
+          rethrown = true;
+        }
+        std::string content{file_mutex.read_view().value().str()};
+        auto tmp_path = std::filesystem::path{file_path}.concat(".sys_tmp");
+        test_lib::assert_equal(rethrown, true);
+        test_lib::assert_equal(content, std::string{"old content"});
+        test_lib::assert_equal(std::filesystem::exists(tmp_path), false);
+      }
+    )
+    .add_test(
+      "write_replace_reports_open_error",
+      [=]() {
+        std::filesystem::path file_path = tmp_fd / test_lib::random_string(10);
+        std::filesystem::create_directory(std::filesystem::path{file_path}.concat(".sys_tmp"));
+        auto file_mutex = T::create(file_path).value();
+        auto replaced = file_mutex.write_replace([](std::ostream &out) { out << "content"; });
+        test_lib::assert_equal(replaced.has_value(), false);
+        test_lib::assert_equal(replaced.error().code() == std::errc::is_a_directory, true);
+      }
+    );
+}
+
+template <typename T>
+auto undefined_behaviour_tester(
+  const std::string &test_suite, const std::filesystem::path &tmp_fd
+) {
+  return test_lib::make_tester(test_suite)
+    .add_test(
+      "unlock_without_lock",
+      [&]() {
+        auto fpath = tmp_fd / test_lib::random_string(10);
+        auto lock = T::create(fpath).value();
+        lock.unlock();
+      }
+    )
+    .add_test(
+      "unlock_shared_without_lock",
+      [&]() {
+        auto fpath = tmp_fd / test_lib::random_string(10);
+        T::create(fpath).value().unlock_shared();
+      }
+    )
+    .add_test("duplicate", [&]() {
+      auto fpath = tmp_fd / test_lib::random_string(10);
+      auto lock = T::create(fpath).value();
+      auto lock_dup = T::create(fpath).value();
+    });
+}
+
+int main(int argc, char **argv, const char **envp) {
+  process::env::init_global(envp);
+  const std::filesystem::path tmp_fd{"tmp"};
+  DirGuard dir_guard{tmp_fd};
+  // mutex_tester<file_lock::FcntlMutex>("basic::FcntlMutex", tmp_fd).print_or_exit();
+  mutex_tester<file_lock::file_mutex>("basic::file_mutex", tmp_fd).print_or_exit();
+  mutex_tester<file_lock::lf_mutex>("basic::lf_mutex", tmp_fd).print_or_exit();
+  mutex_tester<file_lock::range_mutex>("basic::range_mutex", tmp_fd).print_or_exit();
+  mutex_tester<file_lock::lf_range_mutex>("basic::lf_range_mutex", tmp_fd).print_or_exit();
+  registry_tester<file_lock::file_mutex>("registry::file_mutex", tmp_fd).print_or_exit();
+  registry_tester<file_lock::lf_mutex>("registry::lf_mutex", tmp_fd).print_or_exit();
+  registry_tester<file_lock::range_mutex>("registry::range_mutex", tmp_fd).print_or_exit();
+  timed_tester<file_lock::file_mutex>("timed::file_mutex", tmp_fd).print_or_exit();
+  timed_tester<file_lock::lf_mutex>("timed::lf_mutex", tmp_fd).print_or_exit();
+  timed_tester<file_lock::lf_futex_mutex>("timed::lf_futex_mutex", tmp_fd).print_or_exit();
+  nested_shared_tester<file_lock::file_mutex>("nested_shared::file_mutex", tmp_fd).print_or_exit();
+  nested_shared_tester<file_lock::lf_mutex>("nested_shared::lf_mutex", tmp_fd).print_or_exit();
+  lock_many_tester<file_lock::file_mutex>("lock_many::file_mutex", tmp_fd).print_or_exit();
+  lock_many_tester<file_lock::lf_mutex>("lock_many::lf_mutex", tmp_fd).print_or_exit();
+  lock_many_tester<file_lock::lf_futex_mutex>("lock_many::lf_futex_mutex", tmp_fd)
+    .print_or_exit();
+  lock_table_tester("lock_table", tmp_fd).print_or_exit();
+  lock_directory_tester("lock_directory", tmp_fd).print_or_exit();
+  version_tester("version", tmp_fd).print_or_exit();
+  mutex_tester<file_lock::ofd_file_mutex>("basic::ofd_file_mutex", tmp_fd).print_or_exit();
+  mutex_tester<file_lock::posix_file_mutex>("basic::posix_file_mutex", tmp_fd).print_or_exit();
+  error_code_tester<file_lock::file_mutex>("error_code::file_mutex", tmp_fd).print_or_exit();
+  error_code_tester<file_lock::ofd_file_mutex>("error_code::ofd_file_mutex", tmp_fd)
+    .print_or_exit();
+  error_code_tester<file_lock::posix_file_mutex>("error_code::posix_file_mutex", tmp_fd)
+    .print_or_exit();
+  error_code_tester<file_lock::lf_mutex>("error_code::lf_mutex", tmp_fd).print_or_exit();
+  combining_tester<file_lock::file_mutex>("combining::file_mutex", tmp_fd).print_or_exit();
+  combining_tester<file_lock::lf_mutex>("combining::lf_mutex", tmp_fd).print_or_exit();
+  semaphore_tester("semaphore::file_semaphore", tmp_fd).print_or_exit();
+  hierarchy_tester("hierarchy::lock_hierarchy", tmp_fd).print_or_exit();
+  condition_tester<file_lock::file_mutex>("condition::file_mutex", tmp_fd).print_or_exit();
+  condition_tester<file_lock::lf_mutex>("condition::lf_mutex", tmp_fd).print_or_exit();
+  lease_tester<file_lock::file_mutex>("lease::file_mutex", tmp_fd).print_or_exit();
+  lease_tester<file_lock::lf_mutex>("lease::lf_mutex", tmp_fd).print_or_exit();
+  cohort_tester<file_lock::file_mutex>("cohort::file_mutex", tmp_fd).print_or_exit();
+  cohort_tester<file_lock::lf_mutex>("cohort::lf_mutex", tmp_fd).print_or_exit();
+  lazy_tester<file_lock::lazy_file_mutex>("lazy::file_mutex", tmp_fd).print_or_exit();
+  lazy_tester<file_lock::lazy_lf_mutex>("lazy::lf_mutex", tmp_fd).print_or_exit();
+  reader_bias_tester<file_lock::file_mutex>("reader_bias::file_mutex", tmp_fd).print_or_exit();
+  reader_bias_tester<file_lock::lf_mutex>("reader_bias::lf_mutex", tmp_fd).print_or_exit();
+  fairness_tester<file_lock::file_mutex>("fairness::file_mutex", tmp_fd).print_or_exit();
+  fairness_tester<file_lock::lf_mutex>("fairness::lf_mutex", tmp_fd).print_or_exit();
+  upgrade_tester<file_lock::file_mutex>("upgrade::file_mutex", tmp_fd).print_or_exit();
+  upgrade_tester<file_lock::lf_mutex>("upgrade::lf_mutex", tmp_fd).print_or_exit();
+  mapped_view_tester<file_lock::lf_mutex>("mapped_view::lf_mutex", tmp_fd)
+    .print_or_exit();
+  stats_tester<file_lock::file_mutex>("stats::file_mutex", tmp_fd).print_or_exit();
+  stats_tester<file_lock::lf_mutex>("stats::lf_mutex", tmp_fd).print_or_exit();
+  async_tester<file_lock::file_mutex>("async::file_mutex", tmp_fd).print_or_exit();
+  async_tester<file_lock::lf_mutex>("async::lf_mutex", tmp_fd).print_or_exit();
+  async_tester<file_lock::lf_futex_mutex>("async::lf_futex_mutex", tmp_fd).print_or_exit();
+  range_tester<file_lock::range_mutex>("range::range_mutex", tmp_fd).print_or_exit();
+  range_tester<file_lock::lf_range_mutex>("range::lf_range_mutex", tmp_fd).print_or_exit();
+  fuzzer_tester<file_lock::file_mutex>("fuzzer::file_mutex", tmp_fd).print_or_exit();
+  fuzzer_tester<file_lock::lf_mutex>("fuzzer::lf_mutex", tmp_fd).print_or_exit();
+  mutex_tester<file_lock::lf_futex_mutex>("basic::lf_futex_mutex", tmp_fd).print_or_exit();
+  fuzzer_tester<file_lock::lf_futex_mutex>("fuzzer::lf_futex_mutex", tmp_fd).print_or_exit();
+  undefined_behaviour_tester<file_lock::file_mutex>("undefined::file_mutex", tmp_fd)
+    .print_or_exit();
+  undefined_behaviour_tester<file_lock::lf_mutex>("undefined::lf_mutex", tmp_fd).print_or_exit();
+  undefined_behaviour_tester<file_lock::range_mutex>("undefined::range_mutex", tmp_fd)
+    .print_or_exit();
+  undefined_behaviour_tester<file_lock::futex_mutex>("undefined::futex_mutex", tmp_fd)
+    .print_or_exit();
   // mutex_store_tester.print_or_exit();
 }
\ No newline at end of file